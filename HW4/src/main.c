@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -10,10 +11,13 @@
 #include <stdatomic.h>
 #include <signal.h>
 #include <errno.h>
+#include <getopt.h>
+#include <sys/sendfile.h>
 
 // Maximum path length for file and directory names
 #define MAX_PATH 1024
 #define HASH_TABLE_SIZE 100  // Define size for the hash table
+#define KERNEL_CHUNK (1L << 30)  // Bytes requested per copy_file_range/sendfile call
 
 // Global flag to indicate program termination
 volatile sig_atomic_t termination_flag = 0;
@@ -24,6 +28,17 @@ void sigint_handler(int signum) {
     printf("\nSIGINT received. Exiting...\n");
 }
 
+// Path a file took through copy_file(), kernel-side paths first
+typedef enum {
+    COPY_COPY_FILE_RANGE,       // In-kernel copy, may reflink on CoW filesystems
+    COPY_SENDFILE,              // Page cache to file, works across filesystems
+    COPY_READ_WRITE,            // User-space buffer, always works
+    COPY_EMPTY,                 // No data to copy, no backend was used
+    COPY_METHOD_COUNT
+} copy_method_t;
+
+static const char *copy_method_names[COPY_METHOD_COUNT] = {"copy_file_range", "sendfile", "read/write", "none"};
+
 // Structure to hold source and destination file paths
 typedef struct {
     char src[MAX_PATH];
@@ -54,6 +69,8 @@ typedef struct {
     atomic_int fifo_files;      // Number of FIFO files copied
     atomic_int directories;     // Number of directories copied
     atomic_llong total_bytes;   // Total bytes copied
+    atomic_int method_files[COPY_METHOD_COUNT];  // Files finished by each copy path
+    int verbose;                // Print every copied file
     pthread_mutex_t output_mutex;  // Mutex for synchronizing output
 } thread_params_t;
 
@@ -63,7 +80,7 @@ void init_buffer(buffer_t *buffer, int capacity);
 void destroy_buffer(buffer_t *buffer);
 void buffer_add(buffer_t *buffer, file_info_t *file_info);
 int buffer_remove(buffer_t *buffer, file_info_t *file_info);
-void copy_file(const char *src, const char *dst, int buffer_size);
+int copy_file(const char *src, const char *dst, int buffer_size, copy_method_t *method, long long *bytes);
 void traverse_directory(const char *src_dir, const char *dst_dir, buffer_t *buffer, thread_params_t *params);
 
 int main(int argc, char *argv[]) {
@@ -73,15 +90,29 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <buffer_size> <num_workers> <src_dir> <dst_dir>\n", argv[0]);
+    static const struct option long_options[] = {
+        {"verbose", no_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0}
+    };
+    int verbose = 0;                      // Per-file copy report
+    int opt;
+    while ((opt = getopt_long(argc, argv, "v", long_options, NULL)) != -1) {
+        if (opt != 'v') {
+            fprintf(stderr, "Usage: %s [-v|--verbose] <buffer_size> <num_workers> <src_dir> <dst_dir>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        verbose = 1;
+    }
+
+    if (argc - optind != 4) {
+        fprintf(stderr, "Usage: %s [-v|--verbose] <buffer_size> <num_workers> <src_dir> <dst_dir>\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    int buffer_size = atoi(argv[1]);      // Buffer size
-    int num_workers = atoi(argv[2]);      // Number of worker threads
-    char *src_dir = argv[3];              // Source directory
-    char *dst_dir = argv[4];              // Destination directory
+    int buffer_size = atoi(argv[optind]);       // Buffer size
+    int num_workers = atoi(argv[optind + 1]);   // Number of worker threads
+    char *src_dir = argv[optind + 2];           // Source directory
+    char *dst_dir = argv[optind + 3];           // Destination directory
 
     buffer_t buffer;
     init_buffer(&buffer, buffer_size);    // Initialize the buffer
@@ -98,7 +129,11 @@ int main(int argc, char *argv[]) {
         .fifo_files = ATOMIC_VAR_INIT(0),
         .directories = ATOMIC_VAR_INIT(0),
         .total_bytes = ATOMIC_VAR_INIT(0),
+        .verbose = verbose,
     };
+    for (int i = 0; i < COPY_METHOD_COUNT; i++) {
+        atomic_init(&params.method_files[i], 0);
+    }
 
     strncpy(params.src_dir, src_dir, MAX_PATH); // Copy source and destination directory paths
     strncpy(params.dst_dir, dst_dir, MAX_PATH); // to the thread parameters
@@ -134,6 +169,10 @@ int main(int argc, char *argv[]) {
     printf("Number of FIFO Files: %d\n", params.fifo_files);
     printf("Number of Directories: %d\n", params.directories);
     printf("TOTAL BYTES COPIED: %lld\n", params.total_bytes);
+    for (int i = 0; i < COPY_EMPTY; i++) {
+        printf("Files copied via %s: %d\n", copy_method_names[i], params.method_files[i]);
+    }
+    printf("Empty Files (no copy path used): %d\n", params.method_files[COPY_EMPTY]);
     printf("TOTAL TIME: %02ld:%02ld.%03ld (min:sec.mili)\n", minutes, seconds, milliseconds);
 
     destroy_buffer(&buffer);              // Destroy the buffer and free resources
@@ -210,9 +249,20 @@ void *worker_thread(void *arg) {
     file_info_t file_info;    // Variable to hold file information
 
     while (!termination_flag) {
-        if (buffer_remove(params->buffer, &file_info)) {    // Remove file information from the buffer
-            copy_file(file_info.src, file_info.dst, params->buffer_size);   // Copy the file
+        if (!buffer_remove(params->buffer, &file_info)) {   // Remove file information from the buffer
+            break;  // Buffer is empty and manager is done
+        }
+        copy_method_t method;   // Path the copy took
+        long long bytes;        // Bytes written to the destination
+        if (copy_file(file_info.src, file_info.dst, params->buffer_size, &method, &bytes) == 0) {   // Copy the file
             atomic_fetch_add(&params->total_files, 1);  // Increment total files copied
+            atomic_fetch_add(&params->total_bytes, bytes);  // Increment total bytes copied
+            atomic_fetch_add(&params->method_files[method], 1);    // Count the path it took
+            if (params->verbose) {
+                pthread_mutex_lock(&params->output_mutex);   // Lock the output mutex
+                printf("Copied %s (%lld bytes via %s)\n", file_info.dst, bytes, copy_method_names[method]);
+                pthread_mutex_unlock(&params->output_mutex);   // Unlock the output mutex
+            }
         }
     }
 
@@ -223,36 +273,104 @@ void *worker_thread(void *arg) {
     return NULL;    // Exit the worker thread
 }
 
-// Copy file from source to destination
-void copy_file(const char *src, const char *dst, int buffer_size) {
+// Errors meaning the kernel path cannot handle this pair of files (e.g. across filesystems)
+static int kernel_copy_unsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+}
+
+// Write all count bytes, retrying short writes and interrupted calls; returns -1 on error
+static int write_all(int fd, const char *buffer, ssize_t count) {
+    while (count > 0) {
+        ssize_t n = write(fd, buffer, count);
+        if (n == -1) {
+            if (errno == EINTR) continue;   // Interrupted before anything was written
+            return -1;
+        }
+        buffer += n;
+        count -= n;
+    }
+    return 0;
+}
+
+// Copy file from source to destination.
+// copy_file_range() and sendfile() move the data inside the kernel; both advance the file
+// offsets, so when one of them is refused the next path continues from the same position.
+// A file that reports size 0 goes straight to read/write, which still copies pseudo files
+// that report size 0 but have content; one that really is empty is recorded as COPY_EMPTY.
+int copy_file(const char *src, const char *dst, int buffer_size, copy_method_t *method, long long *bytes) {
+    *bytes = 0;
+    *method = COPY_COPY_FILE_RANGE;
     int src_fd = open(src, O_RDONLY);    // Open source file for reading
     if (src_fd == -1) {
         perror("open src");
-        return;
+        return -1;
     }
     int dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);   // Open destination file for writing
     if (dst_fd == -1) {
         perror("open dst");
         close(src_fd);
-        return;
+        return -1;
+    }
+
+    struct stat st;
+    int maybe_empty = fstat(src_fd, &st) == 0 && st.st_size == 0;
+    ssize_t n = 0;
+    while (!maybe_empty && (n = copy_file_range(src_fd, NULL, dst_fd, NULL, KERNEL_CHUNK, 0)) > 0) {    // Kernel-side copy
+        *bytes += n;
+    }
+    if (n == -1 && !kernel_copy_unsupported(errno)) {
+        perror("copy_file_range");
+        close(src_fd);
+        close(dst_fd);
+        return -1;
+    }
+    if (n == 0 && *bytes > 0) {     // Whole file copied in the kernel
+        close(src_fd);
+        close(dst_fd);
+        return 0;
     }
 
+    // copy_file_range refused, or returned 0 on a file that may be a pseudo file: try sendfile
+    *method = COPY_SENDFILE;
+    long long before = *bytes;
+    while (!maybe_empty && (n = sendfile(dst_fd, src_fd, NULL, KERNEL_CHUNK)) > 0) {
+        *bytes += n;
+    }
+    if (n == -1 && !kernel_copy_unsupported(errno)) {
+        perror("sendfile");
+        close(src_fd);
+        close(dst_fd);
+        return -1;
+    }
+    if (n == 0 && *bytes > before) {
+        close(src_fd);
+        close(dst_fd);
+        return 0;
+    }
+
+    *method = COPY_READ_WRITE;
     char buffer[buffer_size];    // Buffer for copying file contents
-    ssize_t bytes_read, bytes_written;
-    while ((bytes_read = read(src_fd, buffer, buffer_size)) > 0) {    // Read from source file
-        bytes_written = write(dst_fd, buffer, bytes_read);    // Write to destination file
-        if (bytes_written == -1) {
+    ssize_t bytes_read;
+    while ((bytes_read = read(src_fd, buffer, buffer_size)) != 0) {    // Read from source file
+        if (bytes_read == -1) {
+            if (errno == EINTR) continue;   // Interrupted before any data arrived
+            perror("read");
+            break;
+        }
+        if (write_all(dst_fd, buffer, bytes_read) == -1) {    // Write to destination file
             perror("write");
             close(src_fd);
             close(dst_fd);
-            return;
+            return -1;
         }
+        *bytes += bytes_read;
     }
-    if (bytes_read == -1) {
-        perror("read");
+    if (bytes_read == 0 && *bytes == 0) {
+        *method = COPY_EMPTY;   // Created empty, no data went through any path
     }
     close(src_fd);    // Close source file
     close(dst_fd);    // Close destination file
+    return bytes_read == -1 ? -1 : 0;
 }
 
 // Traverse the source directory and add files to the buffer
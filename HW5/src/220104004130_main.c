@@ -1,19 +1,22 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/time.h>
 #include <stdatomic.h>
 #include <signal.h>
 #include <errno.h>
-
-// Maximum path length for file and directory names
-#define MAX_PATH 1024
-#define HASH_TABLE_SIZE 100  // Define size for the hash table
+#include <getopt.h>
+#include "copier.h"
+#include "sync.h"
+#include "traverse.h"
+#include "uring_copy.h"
 
 // Global flag to indicate program termination
 volatile sig_atomic_t termination_flag = 0;
@@ -25,49 +28,53 @@ void sigint_handler() {
 	termination_flag = 1;
 }
 
-// Structure to hold source and destination file paths
-typedef struct {
-	char src[MAX_PATH];
-	char dst[MAX_PATH];
-} file_info_t;
-
-
-// Buffer structure for storing file information to be processed by workers
-typedef struct {
-	file_info_t *buffer;        // Array of file information
-	int capacity;               // Maximum number of items in the buffer
-	int count;                  // Current number of items in the buffer
-	int in;                     // Index for the next write operation
-	int out;                    // Index for the next read operation
-	int done;                   // Flag indicating if the manager is done producing
-	pthread_mutex_t mutex;      // Mutex for synchronizing access to the buffer
-	pthread_cond_t not_empty;   // Condition variable for buffer not empty
-	pthread_cond_t not_full;    // Condition variable for buffer not full
-} buffer_t;
-
-typedef struct {
-	buffer_t *buffer;           // Shared buffer between manager and workers
-	int buffer_size;            // Size of the buffer
-	int num_workers;            // Number of worker threads
-	char src_dir[MAX_PATH];     // Source directory path
-	char dst_dir[MAX_PATH];     // Destination directory path
-	atomic_int total_files;     // Total number of files copied
-	atomic_int regular_files;   // Number of regular files copied
-	atomic_int fifo_files;      // Number of FIFO files copied
-	atomic_int directories;     // Number of directories copied
-	atomic_llong total_bytes;   // Total bytes copied
-	pthread_mutex_t output_mutex;  // Mutex for synchronizing output
-	pthread_barrier_t barrier;  // Barrier for synchronizing worker threads
-} thread_params_t;
+// Parse a byte count with an optional K, M, G or T suffix; returns -1 if invalid
+static long long parse_size(const char *text) {
+	char *end;
+	long long value = strtoll(text, &end, 10);
+	if (end == text || value < 0) return -1;
+	switch (*end) {
+		case 'T': case 't': value <<= 10; // fall through
+		case 'G': case 'g': value <<= 10; // fall through
+		case 'M': case 'm': value <<= 10; // fall through
+		case 'K': case 'k': value <<= 10; end++; break;
+		case '\0': break;
+		default: return -1;
+	}
+	return *end == '\0' ? value : -1;
+}
 
-void *manager_thread(void *arg);
-void *worker_thread(void *arg);
-void init_buffer(buffer_t *buffer, int capacity);
-void destroy_buffer(buffer_t *buffer);
-void buffer_add(buffer_t *buffer, file_info_t *file_info);
-int buffer_remove(buffer_t *buffer, file_info_t *file_info);
-void copy_file(const char *src, const char *dst, int buffer_size);
-void traverse_directory(const char *src_dir, const char *dst_dir, buffer_t *buffer, thread_params_t *params);
+// Print command line usage
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [options] <buffer_size> <num_workers|auto> <src_dir> <dst_dir> [dst_dir...]\n", prog);
+	fprintf(stderr, "  num_workers auto resizes the active workers (up to %d per CPU) for the best throughput\n", POOL_CPU_FACTOR);
+	fprintf(stderr, "  several dst_dirs (up to %d) get the same tree, every file is read once and written to all of them\n", FANOUT_MAX);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -e, --engine=NAME   copy backend: auto (reflink first on CoW filesystems), copy_file_range, sendfile, splice, rw (default auto)\n");
+	fprintf(stderr, "  -v, --verbose       print every directory and file as it is queued and the copy backend used for it\n");
+	fprintf(stderr, "  -i, --progress[=S]  report rates, queue depth and ETA every S seconds, 0 disables (default 1 when stderr is a terminal)\n");
+	fprintf(stderr, "  -O, --direct        copy with O_DIRECT through page-aligned per-worker buffers (at least %d KiB)\n", COPY_DIRECT_MIN >> 10);
+	fprintf(stderr, "  -N, --drop-cache    buffered copies flush and drop the copied pages so bulk copies do not evict the cache\n");
+	fprintf(stderr, "  -j, --json=FILE     write per-worker throughput, latency histograms and queue depth samples to FILE\n");
+	fprintf(stderr, "  -s, --split-threshold=SIZE  copy files larger than SIZE in parallel chunks, 0 disables (default 1G)\n");
+	fprintf(stderr, "  -k, --chunk-size=SIZE       bytes per chunk of a split file (default 256M)\n");
+	fprintf(stderr, "  -b, --batch=N       tasks queued and dequeued per buffer operation (default %d, max %d)\n", TASK_BATCH_DEFAULT, TASK_BATCH_MAX);
+	fprintf(stderr, "  -S, --sync          skip files whose destination has the same size and mtime\n");
+	fprintf(stderr, "  -c, --checksum      sync by comparing contents instead of mtime (implies --sync)\n");
+	fprintf(stderr, "  -d, --delete        sync removes destination entries missing from the source (implies --sync)\n");
+	fprintf(stderr, "  -D, --delta[=SIZE]  rewrite only the SIZE blocks of an existing destination that differ (default 128K, implies --sync)\n");
+	fprintf(stderr, "  -x, --dedup[=MODE]  files identical to one already copied become reflinks (clone, default) or hardlinks (link)\n");
+	fprintf(stderr, "  -J, --journal=FILE  record finished files, chunks and subtrees in FILE so an interrupted copy can resume\n");
+	fprintf(stderr, "  -R, --resume        continue the copy recorded in the --journal FILE, skipping what it lists as finished\n");
+	fprintf(stderr, "  -T, --tar           write <dst_dir> as a tar archive instead (- for standard output), read by the workers in parallel\n");
+	fprintf(stderr, "  -V, --verify        hash the source while copying (CRC32C, read/write path) and re-read every destination afterwards to compare\n");
+	fprintf(stderr, "  -n, --plan          dry run: size the tree, print a size histogram and predict the copy time from a short calibration copy\n");
+	fprintf(stderr, "  -P, --preserve[=N]  keep mode, ownership, timestamps and xattrs, applied by N finaliser threads (default %d)\n", META_DEFAULT_THREADS);
+	fprintf(stderr, "  -p, --schedule=MODE queue order: fifo (directory order, default) or largest (biggest known files first)\n");
+	fprintf(stderr, "  -L, --device-limit=N  queue files per source and destination device, at most N in flight per device pair\n");
+	fprintf(stderr, "  -t, --walkers=N     directory traversal threads (default min(num_workers, %d))\n", TRAVERSE_DEFAULT_MAX);
+	fprintf(stderr, "  -u, --io-uring[=N]  asynchronous io_uring workers with N requests in flight each (default %d)\n", URING_DEFAULT_DEPTH);
+}
 
 int main(int argc, char *argv[]) {
 	// Install signal handler for SIGINT
@@ -76,15 +83,253 @@ int main(int argc, char *argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	if (argc != 5) {
-		fprintf(stderr, "Usage: %s <buffer_size> <num_workers> <src_dir> <dst_dir>\n", argv[0]);
+	static const struct option long_options[] = {
+		{"engine", required_argument, NULL, 'e'},
+		{"verbose", no_argument, NULL, 'v'},
+		{"json", required_argument, NULL, 'j'},
+		{"direct", no_argument, NULL, 'O'},
+		{"drop-cache", no_argument, NULL, 'N'},
+		{"io-uring", optional_argument, NULL, 'u'},
+		{"walkers", required_argument, NULL, 't'},
+		{"split-threshold", required_argument, NULL, 's'},
+		{"chunk-size", required_argument, NULL, 'k'},
+		{"batch", required_argument, NULL, 'b'},
+		{"sync", no_argument, NULL, 'S'},
+		{"checksum", no_argument, NULL, 'c'},
+		{"delete", no_argument, NULL, 'd'},
+		{"delta", optional_argument, NULL, 'D'},
+		{"dedup", optional_argument, NULL, 'x'},
+		{"journal", required_argument, NULL, 'J'},
+		{"resume", no_argument, NULL, 'R'},
+		{"schedule", required_argument, NULL, 'p'},
+		{"preserve", optional_argument, NULL, 'P'},
+		{"tar", no_argument, NULL, 'T'},
+		{"progress", optional_argument, NULL, 'i'},
+		{"device-limit", required_argument, NULL, 'L'},
+		{"plan", no_argument, NULL, 'n'},
+		{"verify", no_argument, NULL, 'V'},
+		{NULL, 0, NULL, 0}
+	};
+	copy_engine_t engine = ENGINE_AUTO;   // Copy backend
+	int verbose = 0;                      // Per-file backend report
+	const char *json_path = NULL;         // JSON statistics report
+	int direct = 0, drop_cache = 0;       // Page cache handling
+	int uring_depth = 0;                  // io_uring queue depth, 0 keeps blocking workers
+	int num_walkers = 0;                  // Traversal threads, 0 picks the default
+	long long split_threshold = SPLIT_DEFAULT_THRESHOLD;  // Large file cutoff
+	long long chunk_size = SPLIT_DEFAULT_CHUNK;           // Bytes per chunk
+	int batch_size = TASK_BATCH_DEFAULT;  // Tasks per buffer operation
+	int sync = 0, checksum = 0, delete_extraneous = 0;     // Incremental sync options
+	long long delta_block = 0;            // Delta mode block size, 0 copies changed files whole
+	int dedup = 0;                        // Link or clone duplicate files
+	dedup_mode_t dedup_mode = DEDUP_CLONE;
+	const char *journal_path = NULL;      // Checkpoint journal
+	int resume = 0;                       // Continue from the journal instead of starting over
+	sched_mode_t sched_mode = SCHEDULE_FIFO; // Order in which queued files reach the workers
+	int meta_threads = 0;                 // Metadata finaliser threads, 0 keeps the default 0644 files
+	int archive = 0;                      // Stream a tar archive instead of copying
+	int device_limit = 0;                 // In-flight tasks per device pair, 0 for one shared queue
+	int planning = 0;                     // Only size the tree and predict the copy time
+	int verifying = 0;                    // Hash sources while copying and re-read the destinations
+	int progress_ms = isatty(STDERR_FILENO) ? PROGRESS_DEFAULT_MS : 0;    // Progress report interval, 0 for none
+	int opt;
+	while ((opt = getopt_long(argc, argv, "e:vj:ONu::t:s:k:b:ScdD::x::J:Rp:P::Ti::L:nV", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'e':
+				if (parse_copy_engine(optarg, &engine) == -1) {
+					fprintf(stderr, "Unknown copy engine: %s\n", optarg);
+					usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'j':
+				json_path = optarg;
+				break;
+			case 'O':
+				direct = 1;
+				break;
+			case 'N':
+				drop_cache = 1;
+				break;
+			case 'u':
+				uring_depth = optarg ? atoi(optarg) : URING_DEFAULT_DEPTH;
+				if (uring_depth <= 0 || uring_depth > URING_MAX_DEPTH) {
+					fprintf(stderr, "io_uring queue depth must be between 1 and %d\n", URING_MAX_DEPTH);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 't':
+				num_walkers = atoi(optarg);
+				if (num_walkers <= 0) {
+					fprintf(stderr, "walkers must be positive\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 's':
+				split_threshold = parse_size(optarg);
+				if (split_threshold < 0) {
+					fprintf(stderr, "Invalid split threshold: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'k':
+				chunk_size = parse_size(optarg);
+				if (chunk_size <= 0) {
+					fprintf(stderr, "Invalid chunk size: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'b':
+				batch_size = atoi(optarg);
+				if (batch_size <= 0 || batch_size > TASK_BATCH_MAX) {
+					fprintf(stderr, "batch must be between 1 and %d\n", TASK_BATCH_MAX);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'S':
+				sync = 1;
+				break;
+			case 'c':
+				sync = checksum = 1;
+				break;
+			case 'd':
+				sync = delete_extraneous = 1;
+				break;
+			case 'D':
+				delta_block = optarg ? parse_size(optarg) : DELTA_DEFAULT_BLOCK;
+				if (delta_block <= 0 || delta_block > (1LL << 30)) {
+					fprintf(stderr, "Invalid delta block size: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				sync = 1;
+				break;
+			case 'x':
+				dedup = 1;
+				if (optarg != NULL && parse_dedup_mode(optarg, &dedup_mode) == -1) {
+					fprintf(stderr, "Unknown dedup mode: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'J':
+				journal_path = optarg;
+				break;
+			case 'R':
+				resume = 1;
+				break;
+			case 'p':
+				if (parse_sched_mode(optarg, &sched_mode) == -1) {
+					fprintf(stderr, "Unknown schedule: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'T':
+				archive = 1;
+				break;
+			case 'n':
+				planning = 1;
+				break;
+			case 'V':
+				verifying = 1;
+				break;
+			case 'L':
+				device_limit = atoi(optarg);
+				if (device_limit <= 0) {
+					fprintf(stderr, "Invalid device limit: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'i':
+				progress_ms = optarg ? (int)(atof(optarg) * 1000) : PROGRESS_DEFAULT_MS;
+				if (progress_ms < 0) {
+					fprintf(stderr, "Invalid progress interval: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'P':
+				meta_threads = optarg ? atoi(optarg) : META_DEFAULT_THREADS;
+				if (meta_threads <= 0 || meta_threads > META_MAX_THREADS) {
+					fprintf(stderr, "preserve threads must be between 1 and %d\n", META_MAX_THREADS);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind < 4 || argc - optind > 3 + FANOUT_MAX) {
+		usage(argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
-	int buffer_size = atoi(argv[1]);      // Buffer size
-	int num_workers = atoi(argv[2]);      // Number of worker threads
-	char *src_dir = argv[3];              // Source directory
-	char *dst_dir = argv[4];              // Destination directory
+	int buffer_size = atoi(argv[optind]);       // Buffer size
+	int auto_workers = strcmp(argv[optind + 1], "auto") == 0;  // Let the pool tuner pick the active count
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1) cpus = 1;
+	int num_workers = auto_workers ? (int)(cpus * POOL_CPU_FACTOR < POOL_MAX_WORKERS ? cpus * POOL_CPU_FACTOR : POOL_MAX_WORKERS)
+			: atoi(argv[optind + 1]);   // Number of worker threads
+	char *src_dir = argv[optind + 2];           // Source directory
+	char *dst_dir = argv[optind + 3];           // Destination directory
+	int num_dsts = argc - optind - 3;           // Further destinations mirror the first one
+	if (buffer_size <= 0 || num_workers <= 0) {
+		fprintf(stderr, "buffer_size and num_workers must be positive\n");
+		exit(EXIT_FAILURE);
+	}
+	if (direct && uring_depth > 0) {
+		fprintf(stderr, "--direct uses the blocking workers and cannot be combined with --io-uring\n");
+		exit(EXIT_FAILURE);
+	}
+	if (resume && journal_path == NULL) {
+		fprintf(stderr, "--resume needs the --journal of the interrupted copy\n");
+		exit(EXIT_FAILURE);
+	}
+	if (archive && (sync || dedup || journal_path != NULL || uring_depth > 0 || direct)) {
+		fprintf(stderr, "--tar cannot be combined with --sync, --dedup, --journal, --io-uring or --direct\n");
+		exit(EXIT_FAILURE);
+	}
+	if (planning && (archive || sync || dedup || journal_path != NULL)) {
+		fprintf(stderr, "--plan cannot be combined with --tar, --sync, --dedup or --journal\n");
+		exit(EXIT_FAILURE);
+	}
+	if (verifying && (archive || planning || sync || dedup || uring_depth > 0)) {
+		fprintf(stderr, "--verify cannot be combined with --tar, --plan, --sync, --dedup or --io-uring\n");
+		exit(EXIT_FAILURE);
+	}
+	if (num_dsts > 1 && (archive || planning || sync || dedup || uring_depth > 0 || direct)) {
+		fprintf(stderr, "Several destinations cannot be combined with --tar, --plan, --sync, --dedup, --io-uring or --direct\n");
+		exit(EXIT_FAILURE);
+	}
+	int archive_fd = -1;          // Tar output
+	if (archive && strcmp(dst_dir, "-") == 0) {
+		archive_fd = dup(STDOUT_FILENO);
+		if (archive_fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {    // Progress output must not mix with the archive
+			perror("dup");
+			exit(EXIT_FAILURE);
+		}
+	} else if (archive && (archive_fd = open(dst_dir, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+		perror(dst_dir);
+		exit(EXIT_FAILURE);
+	}
+	if (archive) {
+		split_threshold = 0;      // Large files are streamed in pieces instead of chunks
+		meta_threads = 0;         // Headers carry mode, owner and mtime anyway
+	}
+	if (planning) {
+		meta_threads = 0;         // Nothing is written
+	}
+	if (verifying) {
+		engine = ENGINE_READ_WRITE;   // Every source byte has to pass through the worker's buffer to be hashed
+		chunk_size = (chunk_size + CHECKSUM_BLOCK - 1) / CHECKSUM_BLOCK * CHECKSUM_BLOCK;  // Chunk digests add up by block
+	}
+	if (num_walkers == 0 && planning) {
+		num_walkers = (int)cpus * PLAN_WALKERS_PER_CPU;     // The walk is the whole job
+	} else if (num_walkers == 0) {
+		num_walkers = num_workers < TRAVERSE_DEFAULT_MAX ? num_workers : TRAVERSE_DEFAULT_MAX;
+	}
 
 	buffer_t buffer;
 	init_buffer(&buffer, buffer_size);    // Initialize the buffer
@@ -96,12 +341,109 @@ int main(int argc, char *argv[]) {
 			.buffer = &buffer,
 			.buffer_size = buffer_size,
 			.num_workers = num_workers,
-			.total_files = ATOMIC_VAR_INIT(0),
+			.num_walkers = num_walkers,
 			.regular_files = ATOMIC_VAR_INIT(0),
 			.fifo_files = ATOMIC_VAR_INIT(0),
 			.directories = ATOMIC_VAR_INIT(0),
-			.total_bytes = ATOMIC_VAR_INIT(0),
+			.hardlinks = ATOMIC_VAR_INIT(0),
+			.symlinks = ATOMIC_VAR_INIT(0),
+			.engine = engine,
+			.direct = direct,
+			.drop_cache = drop_cache,
+			.verbose = verbose,
+			.uring_depth = uring_depth,
+			.split_threshold = split_threshold,
+			.chunk_size = chunk_size,
+			.batch_size = batch_size,
+			.sync = sync,
+			.checksum = checksum,
+			.delete_extraneous = delete_extraneous,
+			.delta_block = delta_block,
 	};
+	atomic_init(&params.skipped_files, 0);
+	atomic_init(&params.skipped_bytes, 0);
+	atomic_init(&params.deleted_entries, 0);
+	atomic_init(&params.resumed_files, 0);
+	atomic_init(&params.resumed_dirs, 0);
+	atomic_init(&params.found_files, 0);
+	atomic_init(&params.found_bytes, 0);
+	atomic_init(&params.walk_done, 0);
+	fanout_t fanout;              // Every destination and its counters
+	if (num_dsts > 1) {
+		fanout_init(&fanout, &argv[optind + 3], num_dsts);
+		params.fanout = &fanout;
+	}
+	if (dedup && (params.dedup = dedup_create(dedup_mode)) == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	if (!archive && !planning && (params.inodes = inode_map_create(params.fanout)) == NULL) {    // Archives store every name in full
+		exit(EXIT_FAILURE);
+	}
+	journal_t journal;            // Checkpoint journal
+	if (journal_path != NULL) {
+		if (journal_open(&journal, journal_path, src_dir, dst_dir, resume) == -1) {
+			exit(EXIT_FAILURE);
+		}
+		params.journal = &journal;
+		if (resume) {
+			printf("Resuming from %s: %zu finished entries\n", journal_path, journal.loaded);
+		}
+	}
+	meta_t meta;                  // Metadata finalisation stage
+	if (meta_threads > 0) {
+		if (meta_start(&meta, meta_threads, params.journal, params.fanout) == -1) {
+			exit(EXIT_FAILURE);
+		}
+		params.meta = &meta;
+	}
+	tar_t tar;                    // Ordered archive writer
+	if (archive) {
+		if (tar_start(&tar, archive_fd, src_dir, num_workers) == -1) {
+			exit(EXIT_FAILURE);
+		}
+		params.tar = &tar;
+	}
+	plan_t plan;                  // Dry run histogram and calibration
+	if (planning) {
+		plan_init(&plan);
+		params.plan = &plan;
+	}
+	verify_t verify;              // Digests of the copied files
+	if (verifying) {
+		verify_init(&verify);
+		params.verify = &verify;
+	}
+	sched_t sched;                // Largest-first dispatcher
+	if (sched_mode == SCHEDULE_LARGEST) {
+		if (sched_init(&sched, &buffer, batch_size, num_workers) == -1) {
+			exit(EXIT_FAILURE);
+		}
+		params.sched = &sched;
+	}
+	devices_t devices;            // Per-device admission
+	if (device_limit > 0) {
+		devices_init(&devices, &buffer, params.sched, batch_size, device_limit);
+		params.devices = &devices;
+	}
+	worker_t worker_args[num_workers];   // Per-worker context and statistics shard
+	params.worker_stats = (worker_stats_t *)aligned_alloc(64, sizeof(worker_stats_t) * num_workers);
+	if (params.worker_stats == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memset(params.worker_stats, 0, sizeof(worker_stats_t) * num_workers);
+	size_t io_size = copy_buffer_size(buffer_size, direct || verifying || num_dsts > 1);    // Per-worker buffer, allocated once for all files
+	char *io_buffers = (char *)aligned_alloc(COPY_IO_ALIGN, io_size * num_workers);
+	if (io_buffers == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < num_workers; i++) {
+		worker_args[i] = (worker_t){.params = &params, .id = i, .stats = &params.worker_stats[i],
+				.copy = {.engine = engine, .buffer_size = buffer_size, .direct = direct, .drop_cache = drop_cache,
+						.buf = io_buffers + io_size * i, .buf_size = io_size}};
+		worker_args[i].copy.hash = verifying ? &worker_args[i].hash : NULL;
+	}
 
 	strncpy(params.src_dir, src_dir, MAX_PATH); // Copy source and destination directory paths
 	strncpy(params.dst_dir, dst_dir, MAX_PATH); // to the thread parameters
@@ -112,10 +454,34 @@ int main(int argc, char *argv[]) {
 	struct timeval start, end;  		// Variables to hold start and end times
 	gettimeofday(&start, NULL);           // Start timing the operation
 
+	worker_pool_t pool;           // Auto mode tuner
+	if (auto_workers) {
+		int initial = cpus < num_workers ? (int)cpus : num_workers;   // Start at one worker per CPU
+		if (pool_start(&pool, &params, initial) == 0) {
+			params.pool = &pool;
+			printf("Auto workers: starting with %d of %d\n", initial, num_workers);
+		}
+	}
+	// The walkers stat regular files only where the size or link count is needed before a
+	// worker opens the file: sync, resuming, the largest-first and device queues, the progress
+	// ETA and the planner. Otherwise the blocking workers find large and hardlinked files from
+	// the fstat copy_file does anyway and split or link them there (defer_task); the io_uring,
+	// dedup and fan-out paths cannot, so splitting or hardlinks with those still stat up front.
+	params.stat_files = sync || resume || planning || params.sched != NULL || params.devices != NULL || progress_ms > 0 ||
+			((split_threshold > 0 || params.inodes != NULL) && (uring_depth > 0 || params.dedup != NULL || params.fanout != NULL));
+	for (int i = 0; i < num_workers && !params.stat_files; i++) {
+		worker_args[i].copy.defer_links = params.inodes != NULL;
+		worker_args[i].copy.defer_above = split_threshold;
+	}
+	progress_t progress;          // Live rates and ETA on stderr
+	int reporting = progress_ms > 0 && progress_start(&progress, &params, progress_ms) == 0;
+	depth_sampler_t sampler;      // Queue depth timeline for the JSON report
+	int sampling = json_path != NULL && depth_sampler_start(&sampler, &buffer) == 0;
+
 	pthread_create(&manager, NULL, manager_thread, &params);  // Create the manager thread
 
 	for (int i = 0; i < num_workers; i++) {
-		pthread_create(&workers[i], NULL, worker_thread, &params);  // Create worker threads
+		pthread_create(&workers[i], NULL, uring_depth > 0 ? uring_worker_thread : worker_thread, &worker_args[i]);  // Create worker threads
 	}
 
 	pthread_join(manager, NULL);          // Wait for manager thread to finish
@@ -124,7 +490,37 @@ int main(int argc, char *argv[]) {
 		pthread_join(workers[i], NULL);   // Wait for all worker threads to finish
 	}
 
+	if (params.meta != NULL) {
+		meta_finish(params.meta);         // Finalise what the workers left queued, then the directories
+	}
+	int archive_failed = archive && (tar_finish(&tar) == -1 || close(archive_fd) == -1);
 	gettimeofday(&end, NULL);             // End timing the operation
+	if (planning) {
+		copy_ctx_t *ctxs[num_workers];    // Calibrate with the workers' own settings and buffers
+		for (int i = 0; i < num_workers; i++) {
+			ctxs[i] = &worker_args[i].copy;
+		}
+		plan_calibrate(&plan, dst_dir, ctxs, params.pool != NULL ? atomic_load(&pool.active) : num_workers);
+	}
+	if (params.sched != NULL) {
+		sched.end_ns = stats_now_ns();
+	}
+	if (params.pool != NULL) {
+		pool_stop(params.pool);
+	}
+	if (sampling) {
+		depth_sampler_stop(&sampler);
+	}
+	if (reporting) {
+		progress_stop(&progress);
+	}
+	if (verifying) {
+		copy_ctx_t *ctxs[num_workers];    // Re-read through the workers' buffers
+		for (int i = 0; i < num_workers; i++) {
+			ctxs[i] = &worker_args[i].copy;
+		}
+		verify_run(&verify, ctxs, num_workers);
+	}
 	long seconds = end.tv_sec - start.tv_sec;   // Calculate elapsed time in seconds
 	long microseconds = end.tv_usec - start.tv_usec;    //microseconds
 	long elapsed_microseconds = (seconds * 1000000) + microseconds; // Total elapsed time in microseconds
@@ -132,171 +528,396 @@ int main(int argc, char *argv[]) {
 	seconds = (elapsed_microseconds % (1000000 * 60)) / 1000000;    // Calculate seconds
 	long milliseconds = (elapsed_microseconds % 1000000) / 1000;    // Calculate milliseconds
 
+	worker_stats_t total;               // Sum of the worker shards
+	stats_sum(params.worker_stats, num_workers, &total);
+
 	printf("\n---------------STATISTICS--------------------\n");
-	printf("Consumers: %d - Buffer Size: %d\n", num_workers, buffer_size);
+	if (params.pool != NULL) {
+		printf("Consumers: auto, up to %d, %d active at the end - Buffer Size: %d\n", num_workers, atomic_load(&pool.active), buffer_size);
+	} else {
+		printf("Consumers: %d - Buffer Size: %d\n", num_workers, buffer_size);
+	}
 	printf("Number of Regular Files: %d\n", params.regular_files);
 	printf("Number of FIFO Files: %d\n", params.fifo_files);
 	printf("Number of Directories: %d\n", params.directories);
-	printf("TOTAL BYTES COPIED: %lld\n", params.total_bytes);
+	printf("Number of Hard Links: %d\n", params.hardlinks);
+	printf("Number of Symbolic Links: %d\n", params.symlinks);
+	printf("TOTAL BYTES COPIED: %lld\n", total.bytes);
+	for (int i = 0; i < COPY_METHOD_COUNT; i++) {
+		if (total.method_files[i] > 0) {
+			printf("  via %-16s %lld files, %lld bytes\n", copy_method_name(i), total.method_files[i], total.method_bytes[i]);
+		}
+	}
+	if (total.hole_bytes > 0) {
+		printf("Sparse Holes Skipped: %lld bytes\n", total.hole_bytes);
+	}
+	if (params.dedup != NULL) {
+		printf("Deduplicated Files: %lld (%lld bytes not written, %lld bytes hashed)\n", total.dedup_files, total.dedup_bytes,
+				(long long)atomic_load(&params.dedup->hashed_bytes));
+	}
+	if (archive) {
+		printf("Archive: %lld bytes written to %s%s\n", (long long)atomic_load(&tar.bytes), dst_dir, archive_failed ? " (FAILED)" : "");
+	}
+	if (params.meta != NULL) {
+		printf("Metadata Preserved: %lld entries (%lld failed)\n", (long long)atomic_load(&meta.applied), (long long)atomic_load(&meta.failed));
+	}
+	if (params.sched != NULL && sched.first_ns > 0) {
+		long long predicted_ns, bound_ns;
+		sched_estimate(&sched, total.busy_ns, &predicted_ns, &bound_ns);
+		printf("Largest-first Schedule: %lld tasks, predicted makespan %.3f s (lower bound %.3f s), actual %.3f s\n",
+				sched.tasks, predicted_ns / 1e9, bound_ns / 1e9, (sched.end_ns - sched.first_ns) / 1e9);
+	}
+	if (params.devices != NULL) {
+		printf("Device Queues: %d, at most %d tasks in flight each\n", devices.num_queues, devices.limit);
+		for (int i = 0; i < devices.num_queues; i++) {
+			device_queue_t *queue = &devices.queues[i];
+			printf("  %u:%u -> %u:%u  %lld tasks, %lld bytes, peak %d in flight, held back %lld times\n",
+					major(queue->src_dev), minor(queue->src_dev), major(queue->dst_dev), minor(queue->dst_dev),
+					queue->dispatched, queue->bytes, queue->peak, queue->throttled);
+		}
+	}
+	if (params.fanout != NULL) {
+		fanout_print(&fanout);
+	}
+	if (params.journal != NULL && resume) {
+		printf("Resumed: %d finished directories and %d finished files not copied again\n", params.resumed_dirs, params.resumed_files);
+	}
+	if (sync) {
+		printf("Skipped Unchanged Files: %lld (%lld bytes)\n", params.skipped_files + total.skipped_files, params.skipped_bytes + total.skipped_bytes);
+		if (delete_extraneous) {
+			printf("Deleted Extraneous Entries: %d\n", params.deleted_entries);
+		}
+	}
 	printf("TOTAL TIME: %02ld:%02ld.%03ld (min:sec.mili)\n", minutes, seconds, milliseconds);
+	int verify_failed = 0;
+	if (verifying) {
+		verify_failed = atomic_load(&verify.mismatched) > 0 || atomic_load(&verify.failed) > 0;
+		printf("Verified: %lld of %zu files (%lld bytes re-read in %.3f s), %lld mismatched, %lld unreadable%s\n",
+				(long long)atomic_load(&verify.files), verify.count, (long long)atomic_load(&verify.bytes), verify.seconds,
+				(long long)atomic_load(&verify.mismatched), (long long)atomic_load(&verify.failed), verify_failed ? " (FAILED)" : "");
+	}
+	if (planning) {
+		plan_print(&plan, elapsed_microseconds / 1e6, params.regular_files + params.fifo_files + params.directories + params.symlinks);
+	}
+	if (json_path != NULL && stats_write_json(json_path, &params, elapsed_microseconds, sampling ? &sampler : NULL) == 0) {
+		printf("Statistics written to %s\n", json_path);
+	}
+	if (sampling) {
+		free(sampler.samples);
+	}
+	free(params.worker_stats);
+	free(io_buffers);
+	if (params.journal != NULL) {
+		journal_close(params.journal);    // Flush the last records
+	}
+	if (params.dedup != NULL) {
+		dedup_destroy(params.dedup);
+	}
+	if (params.inodes != NULL) {
+		inode_map_destroy(params.inodes);
+	}
+	if (sched_mode == SCHEDULE_LARGEST) {
+		sched_destroy(&sched);
+	}
+	if (planning) {
+		plan_destroy(&plan);
+	}
+	if (params.devices != NULL) {
+		devices_destroy(&devices);
+	}
+	if (verifying) {
+		verify_destroy(&verify);
+	}
 
 	destroy_buffer(&buffer);              // Destroy the buffer and free resources
 	pthread_mutex_destroy(&params.output_mutex);    // Destroy the output mutex
 	pthread_barrier_destroy(&params.barrier); // Destroy the barrier
-	return EXIT_SUCCESS;    		  // Exit the program
-}
-
-// Initialize the buffer
-void init_buffer(buffer_t *buffer, int capacity) {
-	buffer->buffer = (file_info_t *)malloc(sizeof(file_info_t) * capacity); // Allocate memory for the buffer
-	buffer->capacity = capacity;        // Set the buffer capacity
-	buffer->count = 0;  			  // Initialize the buffer count
-	buffer->in = 0; 			  // Initialize the buffer in index
-	buffer->out = 0;    // Initialize the buffer out index
-	buffer->done = 0;   // Initialize the done flag
-	pthread_mutex_init(&buffer->mutex, NULL);   // Initialize the buffer mutex
-	pthread_cond_init(&buffer->not_empty, NULL);    // Initialize the not empty condition variable
-	pthread_cond_init(&buffer->not_full, NULL);    // Initialize the not full condition variable
+	return archive_failed || verify_failed ? EXIT_FAILURE : EXIT_SUCCESS;    		  // Exit the program
 }
 
-// Destroy the buffer
-void destroy_buffer(buffer_t *buffer) {
-	free(buffer->buffer);   // Free the buffer memory
-	pthread_mutex_destroy(&buffer->mutex);  // Destroy the buffer mutex
-	pthread_cond_destroy(&buffer->not_empty);   // Destroy the not empty condition variable
-	pthread_cond_destroy(&buffer->not_full);    // Destroy the not full condition variable
+// Manager thread function
+void *manager_thread(void *arg) {
+	thread_params_t *params = (thread_params_t *)arg;    // Get the thread parameters
+	traverse_tree(params);    // Traverse the source directory with the walker threads
+	atomic_store(&params->walk_done, 1);    // The progress ETA no longer grows
+	buffer_set_done(params->buffer);    // Set the done flag and wake all waiting workers
+	if (params->pool != NULL) {
+		pool_release(params->pool);     // Parked workers are no longer needed
+	}
+	pthread_barrier_wait(&params->barrier);  // Wait at the barrier
+	return NULL;
 }
 
-// Add file information to the buffer
-void buffer_add(buffer_t *buffer, file_info_t *file_info) {
-	pthread_mutex_lock(&buffer->mutex);  // Lock the buffer mutex
-	while (buffer->count == buffer->capacity) { // Wait while the buffer is full
-		pthread_cond_wait(&buffer->not_full, &buffer->mutex);   // Wait on the not full condition variable
-	}
-	buffer->buffer[buffer->in] = *file_info;    // Add the file information to the buffer
-	buffer->in = (buffer->in + 1) % buffer->capacity;   // Update the in index
-	buffer->count++;    // Increment the buffer count
-	pthread_cond_signal(&buffer->not_empty);    // Signal that the buffer is not empty
-	pthread_mutex_unlock(&buffer->mutex);   // Unlock the buffer mutex
+// Copy one chunk of a deferred split file in this worker and record it
+static void copy_chunk_here(worker_t *worker, const file_info_t *chunk, const char *src, const char *dst) {
+	copy_result_t result = {0};
+	long long start = stats_now_ns();
+	if (worker->copy.hash != NULL) {
+		checksum_stream_begin(worker->copy.hash, chunk->offset);
+	}
+	int status = copy_file_part(src, dst, chunk->offset, chunk->length, &worker->copy, &result);
+	if (worker->copy.hash != NULL) {
+		result.digest = checksum_stream_end(worker->copy.hash);
+	}
+	record_copy(worker, chunk, status, &result, start);
 }
 
-// Remove file information from the buffer
-int buffer_remove(buffer_t *buffer, file_info_t *file_info) {
-	pthread_mutex_lock(&buffer->mutex); // Lock the buffer mutex
-	while (buffer->count == 0 && !buffer->done) {   // Wait while the buffer is empty and not done
-		pthread_cond_wait(&buffer->not_empty, &buffer->mutex);  // Wait on the not empty condition variable
-	}
-	if (buffer->count == 0 && buffer->done) {   // If the buffer is empty and done
-		pthread_mutex_unlock(&buffer->mutex);   // Unlock the buffer mutex
-		return 0;
-	}
-	*file_info = buffer->buffer[buffer->out];   // Remove the file information from the buffer
-	buffer->out = (buffer->out + 1) % buffer->capacity; // Update the out index
-	buffer->count--;   // Decrement the buffer count
-	pthread_cond_signal(&buffer->not_full);    // Signal that the buffer is not full
-	pthread_mutex_unlock(&buffer->mutex);   // Unlock the buffer mutex
-	return 1;
+// Split a file the walkers queued unstat'ed: size the destination as enqueue_chunks does and
+// queue one task per chunk. While the buffer is full this worker copies the next chunk itself
+// and offers the rest again, so it never blocks on the queue it drains. Returns -1 if the
+// destination cannot be sized.
+static int split_task(worker_t *worker, const file_info_t *file_info, const struct stat *st, const char *src, const char *dst) {
+	thread_params_t *params = worker->params;
+	int dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (dst_fd == -1) {
+		perror("open dst");
+		return -1;
+	}
+	if ((copy_is_sparse(st) || fallocate(dst_fd, 0, 0, st->st_size) == -1) && ftruncate(dst_fd, st->st_size) == -1) {
+		perror("ftruncate");
+		close(dst_fd);
+		return -1;
+	}
+	close(dst_fd);
+	off_t chunk = (off_t)params->chunk_size;
+	int chunks = (int)((st->st_size + chunk - 1) / chunk);
+	chunked_file_t *chunked = (chunked_file_t *)malloc(sizeof(chunked_file_t));
+	if (chunked == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	atomic_init(&chunked->chunks_left, chunks);
+	atomic_init(&chunked->failed, 0);
+	atomic_init(&chunked->bytes, 0);
+	atomic_init(&chunked->skipped, 0);
+	atomic_init(&chunked->start_ns, 0);
+	atomic_init(&chunked->digest, 0);
+	atomic_init(&chunked->failed_dests, 0);
+	file_info_t batch[TASK_BATCH_MAX];
+	for (int next = 0; next < chunks; ) {   // chunked may be freed once its last chunk is recorded
+		int count = chunks - next < TASK_BATCH_MAX ? chunks - next : TASK_BATCH_MAX;
+		for (int i = 0; i < count; i++) {
+			batch[i] = *file_info;
+			batch[i].chunked = chunked;
+			batch[i].offset = (off_t)(next + i) * chunk;
+			batch[i].length = st->st_size - batch[i].offset < chunk ? st->st_size - batch[i].offset : chunk;
+			dir_ref_get(file_info->dir);    // One reference per chunk, like the walkers' queue_task
+		}
+		int added = termination_flag ? 0 : buffer_try_add_batch(params->buffer, batch, count);
+		next += added;
+		if (added == count) continue;
+		for (int i = added + 1; i < count; i++) {   // Offered again after the next chunk
+			dir_ref_put(file_info->dir);
+		}
+		if (termination_flag) {
+			drop_task(&batch[added]);
+		} else {
+			copy_chunk_here(worker, &batch[added], src, dst);   // Buffer full: copy one, then retry the rest
+		}
+		next++;
+	}
+	dir_ref_put(file_info->dir);    // The chunks hold the directory now
+	return 0;
 }
 
-// Manager thread function
-void *manager_thread(void *arg) {
-	thread_params_t *params = (thread_params_t *)arg;    // Get the thread parameters
-	traverse_directory(params->src_dir, params->dst_dir, params->buffer, params);    // Traverse the source directory
-	pthread_mutex_lock(&params->buffer->mutex);   // Lock the buffer mutex
-	params->buffer->done = 1;    // Set the done flag
-	pthread_cond_broadcast(&params->buffer->not_empty);  // Signal all waiting threads that the buffer is not empty
-	pthread_mutex_unlock(&params->buffer->mutex);    // Unlock the buffer mutex
-	pthread_barrier_wait(&params->barrier);  // Wait at the barrier
-	return NULL;
+// copy_file() handed back a file the walkers did not stat (params->stat_files). A later name
+// of a hardlinked inode is linked to the first one's copy, a file above the split threshold
+// is queued again as chunks; both return COPY_DEFER with the task released. Anything else,
+// including the first name of a linked inode, is copied as usual.
+static int defer_task(worker_t *worker, const file_info_t *file_info, const char *src, const char *dst, copy_result_t *result) {
+	thread_params_t *params = worker->params;
+	struct stat st;
+	if (stat(src, &st) == -1) {
+		perror("stat");
+		return -1;
+	}
+	if (worker->copy.defer_links && st.st_nlink > 1) {
+		int dst_dirfd = open(file_info->dir->dst, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		int linked = dst_dirfd != -1 && inode_map_link(params->inodes, &st, dst_dirfd, file_info->dir->dst, file_info->name, NULL) == 1;
+		if (dst_dirfd != -1) close(dst_dirfd);
+		if (linked) {
+			atomic_fetch_add(&params->hardlinks, 1);
+			dir_ref_put(file_info->dir);
+			return COPY_DEFER;
+		}
+	}
+	if (worker->copy.defer_above > 0 && st.st_size > worker->copy.defer_above &&
+			split_task(worker, file_info, &st, src, dst) == 0) {
+		return COPY_DEFER;
+	}
+	copy_ctx_t ctx = worker->copy;  // Same buffer and hash, nothing deferred this time
+	ctx.defer_links = 0;
+	ctx.defer_above = 0;
+	return copy_file(src, dst, &ctx, result);
 }
 
 // Worker thread function
 void *worker_thread(void *arg) {
-	thread_params_t *params = (thread_params_t *)arg;    // Get the thread parameters
-	file_info_t file_info;   // File information
-	while (buffer_remove(params->buffer, &file_info)) {  // Remove file information from the buffer
-		copy_file(file_info.src, file_info.dst, params->buffer_size);   // Copy the file
+	worker_t *worker = (worker_t *)arg;     // This worker's context
+	thread_params_t *params = worker->params;    // Get the thread parameters
+	file_info_t batch[TASK_BATCH_MAX];   // File information
+	char src[MAX_PATH], dst[MAX_PATH];  // Full paths rebuilt from the interned directories
+	char mirrors[FANOUT_MAX][MAX_PATH]; // Fan-out: the same file in every destination
+	char *dsts[FANOUT_MAX] = {dst};
+	for (int i = 1; params->fanout != NULL && i < params->fanout->count; i++) {
+		dsts[i] = mirrors[i];
 	}
+	int count;
+	long long started = stats_now_ns();
+	long long wait_start = started;
+	while ((params->pool == NULL || pool_wait_active(params->pool, worker->id)) &&
+			(count = buffer_remove_batch(params->buffer, batch, params->batch_size)) > 0) {  // Remove file information from the buffer
+		worker->stats->idle_ns += stats_now_ns() - wait_start;    // Time spent blocked on the buffer
+		for (int i = 0; i < count; i++) {
+			file_info_t *file_info = &batch[i];
+			if (termination_flag) {     // SIGINT: release the rest without copying, walkers may wait on a full buffer
+				drop_task(file_info);
+				continue;
+			}
+			long long task_start = stats_now_ns();
+			task_src_path(file_info, src, sizeof(src));
+			task_dst_path(file_info, dst, sizeof(dst));
+			copy_result_t result = {0};    // Backend used and bytes moved, still zero if the open fails
+			int status;
+			if (worker->copy.hash != NULL) {   // Chunks hash from their own offset
+				checksum_stream_begin(worker->copy.hash, file_info->chunked ? file_info->offset : 0);
+			}
+			if (params->tar != NULL) {      // Read into the archive stream
+				status = tar_add_file(params->tar, src, &result);
+			} else if (file_info->flags & TASK_DELTA) {    // Delta: only rewrite the blocks that differ
+				status = copy_file_delta(src, dst, file_info->chunked ? file_info->offset : 0, file_info->chunked ? file_info->length : 0,
+						(size_t)params->delta_block, &result);
+			} else if (file_info->flags & TASK_COMPARE) {  // Sync: only rewrite what differs
+				status = copy_file_if_changed(src, dst, file_info->chunked ? file_info->offset : 0, file_info->chunked ? file_info->length : 0,
+						&worker->copy, &result);
+			} else if (params->fanout != NULL) {    // Read once, write to every destination
+				for (int d = 1; d < params->fanout->count; d++) {
+					fanout_path(params->fanout, d, dst, mirrors[d], sizeof(mirrors[d]));
+				}
+				status = copy_fanout(src, dsts, params->fanout->count, file_info->chunked ? file_info->offset : 0,
+						file_info->chunked ? file_info->length : 0, &worker->copy, &result);
+			} else if (file_info->chunked != NULL) {    // One chunk of a split file
+				status = copy_file_part(src, dst, file_info->offset, file_info->length, &worker->copy, &result);
+			} else if (params->dedup != NULL) {     // Link or clone duplicates, copy the rest
+				status = dedup_copy_file(params->dedup, src, dst, &worker->copy, &result);
+			} else {
+				status = copy_file(src, dst, &worker->copy, &result);   // Copy the file
+				if (status == COPY_DEFER && (status = defer_task(worker, file_info, src, dst, &result)) == COPY_DEFER) {
+					continue;   // Linked, or queued again as chunks
+				}
+			}
+			if (worker->copy.hash != NULL) {
+				result.digest = checksum_stream_end(worker->copy.hash);
+			}
+			record_copy(worker, file_info, status, &result, task_start);
+		}
+		wait_start = stats_now_ns();
+	}
+	worker->stats->idle_ns += stats_now_ns() - wait_start;
+	worker->stats->busy_ns = stats_now_ns() - started - worker->stats->idle_ns;
 	pthread_barrier_wait(&params->barrier);  // Wait at the barrier
 	return NULL;
 }
 
-// Function to copy a file from src to dst with a specified buffer size
-void copy_file(const char *src, const char *dst, int buffer_size) {
-	int src_fd, dst_fd;    // Source and destination file descriptors
-	char *buffer = (char *)malloc(buffer_size);  // Allocate memory for the buffer
-	ssize_t bytes_read, bytes_written;   // Variables to hold bytes read and written
-	src_fd = open(src, O_RDONLY);    // Open the source file
-	if (src_fd == -1) {
-		perror("open src");
-		free(buffer);
-		return;
-	}
-	dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);    // Open the destination file
-	if (dst_fd == -1) {
-		perror("open dst");
-		close(src_fd);
-		free(buffer);
-		return;
-	}
-	while ((bytes_read = read(src_fd, buffer, buffer_size)) > 0) {  // Read from the source file
-		bytes_written = write(dst_fd, buffer, bytes_read);  // Write to the destination file
-		if (bytes_written != bytes_read) {
-			perror("write");
-			break;
+// Account for one finished copy task in the worker's shard and drop its directory reference.
+// A chunk of a split file only completes the file when it is the last of its chunks to finish;
+// the file's latency then runs from the earliest chunk start.
+void record_copy(worker_t *worker, const file_info_t *file_info, int status, const copy_result_t *result, long long start_ns) {
+	thread_params_t *params = worker->params;
+	worker_stats_t *stats = worker->stats;
+	if (file_info->dir->devices != NULL) {
+		devices_release(file_info->dir->devices, file_info->dir->device, result->bytes);    // Lets the next task of this device in
+	}
+	atomic_fetch_add_explicit(&stats->bytes, result->bytes, memory_order_relaxed);    // Count bytes even for partial copies
+	atomic_fetch_add_explicit(&stats->done_bytes, result->bytes + result->skipped + result->holes + result->deduped, memory_order_relaxed);
+	stats->method_bytes[result->method] += result->bytes;
+	stats->skipped_bytes += result->skipped;
+	stats->hole_bytes += result->holes;
+	if (result->deduped > 0) {
+		stats->dedup_files++;
+		stats->dedup_bytes += result->deduped;
+	}
+	long long file_bytes = result->bytes;
+	long long file_skipped = result->skipped;
+	uint64_t digest = result->digest;
+	unsigned long long failed_dests = result->failed_dests;
+	chunked_file_t *chunked = file_info->chunked;
+	if (status != 0) {
+		atomic_store(&file_info->dir->incomplete, 1);   // Keeps the directory out of the journal
+	}
+	if (chunked != NULL) {
+		if (status != 0) {
+			atomic_store(&chunked->failed, 1);
+		} else if (params->journal != NULL) {
+			journal_chunk_done(params->journal, file_info->dir->src, file_info->name, file_info->offset, file_info->length);
+		}
+		long long earliest = atomic_load(&chunked->start_ns);
+		while ((earliest == 0 || start_ns < earliest) && !atomic_compare_exchange_weak(&chunked->start_ns, &earliest, start_ns)) {
+		}
+		file_bytes = atomic_fetch_add(&chunked->bytes, result->bytes) + result->bytes;
+		file_skipped = atomic_fetch_add(&chunked->skipped, result->skipped) + result->skipped;
+		digest = atomic_fetch_add(&chunked->digest, result->digest) + result->digest;
+		failed_dests = atomic_fetch_or(&chunked->failed_dests, result->failed_dests) | result->failed_dests;
+		if (atomic_fetch_sub(&chunked->chunks_left, 1) != 1) {
+			dir_ref_put(file_info->dir);
+			return;     // Other chunks of this file are still running
 		}
+		status = atomic_load(&chunked->failed) ? -1 : 0;
+		start_ns = atomic_load(&chunked->start_ns);
+		free(chunked);
 	}
-	if (bytes_read == -1) {
-		perror("read");
+	if (params->fanout != NULL) {
+		fanout_record(params->fanout, failed_dests, file_bytes);
 	}
-	close(src_fd);    // Close the source file
-	close(dst_fd);    // Close the destination file
-	free(buffer);    // Free the buffer memory
+	stats_record_latency(stats, stats_now_ns() - start_ns);
+	atomic_fetch_add_explicit(&stats->done_files, 1, memory_order_relaxed);
+	if (status == 0 && file_bytes == 0 && (file_skipped > 0 || (file_info->flags & (TASK_COMPARE | TASK_DELTA)))) {
+		stats->skipped_files++;    // Contents were already identical
+	} else if (status == 0) {
+		atomic_fetch_add_explicit(&stats->files, 1, memory_order_relaxed);    // Increment the copied file count
+		stats->method_files[result->method]++;
+	}
+	if (status == 0 && params->meta != NULL) {
+		meta_add_file(params->meta, file_info->dir, file_info->name, META_JOURNAL);  // Journaled once finalised
+	} else if (status == 0 && params->journal != NULL) {
+		journal_file_done(params->journal, file_info->dir->src, file_info->name);
+	}
+	if (status == 0 && params->verify != NULL) {
+		char dst[MAX_PATH], mirror[MAX_PATH];
+		task_dst_path(file_info, dst, sizeof(dst));
+		verify_add(params->verify, dst, digest);
+		for (int i = 1; params->fanout != NULL && i < params->fanout->count; i++) {
+			fanout_path(params->fanout, i, dst, mirror, sizeof(mirror));
+			verify_add(params->verify, mirror, digest);     // Every destination was written from the same bytes
+		}
+	}
+	if (status == 0 && params->sync && params->meta == NULL) {
+		char src[MAX_PATH], dst[MAX_PATH];
+		task_src_path(file_info, src, sizeof(src));
+		task_dst_path(file_info, dst, sizeof(dst));
+		sync_copy_times(src, dst);  // Lets the next run skip this file by size and mtime
+	}
+	if (params->verbose) {
+		pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
+		printf("Copied %s/%s -> %s/%s (%lld bytes via %s)\n", file_info->dir->src, file_info->name,
+				file_info->dir->dst, file_info->name, file_bytes, copy_method_name(result->method));
+		pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
+	}
+	dir_ref_put(file_info->dir);
 }
 
-// Function to traverse the source directory and add files to the buffer
-void traverse_directory(const char *src_dir, const char *dst_dir, buffer_t *buffer, thread_params_t *params) {
-	DIR *dir = opendir(src_dir);    // Open the source directory
-	if (!dir) {
-		perror("opendir");
-		return;
-	}
-	struct dirent *entry;    // Directory entry
-	while ((entry = readdir(dir)) != NULL) {   // Read directory entries
-		if (termination_flag) break;   // Check for termination flag
-		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {  // Skip . and ..
-			continue;
-		}
-		char src_path[MAX_PATH];    // Source path
-		char dst_path[MAX_PATH];    // Destination path
-		snprintf(src_path, sizeof(src_path), "%s/%s", src_dir, entry->d_name);   // Create source path
-		snprintf(dst_path, sizeof(dst_path), "%s/%s", dst_dir, entry->d_name);   // Create destination path
-		if (entry->d_type == DT_DIR) {    // If the entry is a directory
-			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
-			printf("Creating directory: %s\n", dst_path);  // Print the directory creation message
-			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
-			mkdir(dst_path, 0755);  // Create the directory
-			atomic_fetch_add(&params->directories, 1);    // Increment the directory count
-			traverse_directory(src_path, dst_path, buffer, params);   // Recursively traverse the directory
-		} else if (entry->d_type == DT_REG) {  // If the entry is a regular file
-			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
-			printf("Adding file to buffer: %s\n", src_path);    // Print the file addition message
-			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
-			file_info_t file_info = {.src = "", .dst = ""};   // Initialize file information
-			strncpy(file_info.src, src_path, MAX_PATH);   // Copy source path to file information
-			strncpy(file_info.dst, dst_path, MAX_PATH);   // Copy destination path to file information
-			buffer_add(buffer, &file_info);    // Add the file information to the buffer
-			atomic_fetch_add(&params->regular_files, 1);    // Increment the regular file count
-		} else if (entry->d_type == DT_FIFO) { // If the entry is a FIFO file
-			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
-			printf("Adding FIFO to buffer: %s\n", src_path);    // Print the FIFO addition message
-			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
-			file_info_t file_info = {.src = "", .dst = ""};   // Initialize file information
-			strncpy(file_info.src, src_path, MAX_PATH);   // Copy source path to file information
-			strncpy(file_info.dst, dst_path, MAX_PATH);   // Copy destination path to file information
-			buffer_add(buffer, &file_info);    // Add the file information to the buffer
-			atomic_fetch_add(&params->fifo_files, 1);    // Increment the FIFO file count
+// Give up on a task that will not be copied after SIGINT: its file counts as failed
+void drop_task(const file_info_t *file_info) {
+	atomic_store(&file_info->dir->incomplete, 1);
+	if (file_info->dir->devices != NULL) {
+		devices_release(file_info->dir->devices, file_info->dir->device, 0);
+	}
+	chunked_file_t *chunked = file_info->chunked;
+	if (chunked != NULL) {
+		atomic_store(&chunked->failed, 1);
+		if (atomic_fetch_sub(&chunked->chunks_left, 1) == 1) {
+			free(chunked);  // No other chunk is left to finish the file
 		}
 	}
-	closedir(dir);   // Close the directory
+	dir_ref_put(file_info->dir);
 }
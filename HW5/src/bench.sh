@@ -0,0 +1,75 @@
+#!/bin/sh
+# Sweep buffer_size x num_workers over a generated tree, cold and warm cache, and append
+# one CSV row per run. BENCH_MODES="copy verify" repeats every run with --verify and
+# reports its re-read pass separately in verify_us. Driven by "make bench"; every knob can
+# be overridden from the environment (see the Makefile).
+set -eu
+
+BIN=${BIN:-./main}
+GENTREE=${GENTREE:-./gentree}
+BENCH_DIR=${BENCH_DIR:-/tmp/hw5-bench}
+BENCH_CSV=${BENCH_CSV:-bench.csv}
+BENCH_BUFFERS=${BENCH_BUFFERS:-"16 64 256"}
+BENCH_WORKERS=${BENCH_WORKERS:-"1 2 4 8"}
+BENCH_CACHES=${BENCH_CACHES:-"cold warm"}
+BENCH_MODES=${BENCH_MODES:-copy}
+BENCH_GEN_ARGS=${BENCH_GEN_ARGS:-}
+BENCH_COPY_ARGS=${BENCH_COPY_ARGS:-}
+
+SRC=$BENCH_DIR/src
+DST=$BENCH_DIR/dst
+REPORT=$BENCH_DIR/report.json
+
+mkdir -p "$BENCH_DIR"
+if [ ! -d "$SRC" ]; then
+	echo "Generating $SRC"
+	# shellcheck disable=SC2086
+	"$GENTREE" $BENCH_GEN_ARGS "$SRC"
+fi
+
+# Pull one numeric field out of the JSON report (one key per line)
+field() {
+	sed -n "s/^  \"$1\": \([0-9]*\),\{0,1\}$/\1/p" "$REPORT"
+}
+
+# Wall time of the verify pass, 0 when the run did not verify
+verify_us() {
+	sed -n 's/^  "verify": {.*"elapsed_us": \([0-9]*\)}.*$/\1/p' "$REPORT" | grep . || echo 0
+}
+
+if [ ! -f "$BENCH_CSV" ]; then
+	echo "date,commit,cache,mode,buffer_size,workers,files,bytes,elapsed_us,verify_us,mib_per_s,files_per_s" > "$BENCH_CSV"
+fi
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+DATE=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+for cache in $BENCH_CACHES; do
+	for mode in $BENCH_MODES; do
+		args=$BENCH_COPY_ARGS
+		[ "$mode" = verify ] && args="$args --verify"
+		for buffer in $BENCH_BUFFERS; do
+			for workers in $BENCH_WORKERS; do
+				rm -rf "$DST"
+				mkdir -p "$DST"
+				sync
+				if [ "$cache" = cold ]; then
+					"$GENTREE" -e "$SRC"
+				else
+					cat "$SRC"/huge/* > /dev/null 2>&1 || true    # Warm the large files
+				fi
+				# shellcheck disable=SC2086
+				"$BIN" $args --json="$REPORT" "$buffer" "$workers" "$SRC" "$DST" > /dev/null
+				files=$(field files)
+				bytes=$(field bytes)
+				elapsed=$(field elapsed_us)
+				verify=$(verify_us)
+				awk -v d="$DATE" -v c="$COMMIT" -v cache="$cache" -v m="$mode" -v b="$buffer" -v w="$workers" \
+					-v f="$files" -v n="$bytes" -v t="$elapsed" -v v="$verify" 'BEGIN {
+					s = t > 0 ? t / 1e6 : 1e-6
+					printf "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%.1f,%.1f\n", d, c, cache, m, b, w, f, n, t, v, n / 1048576 / s, f / s
+				}' | tee -a "$BENCH_CSV"
+			done
+		done
+	done
+done
+rm -rf "$DST"
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include "buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+static void futex_wait(atomic_uint *word, unsigned value) {
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *word, int count) {
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// Initialize the buffer
+void init_buffer(buffer_t *buffer, int capacity) {
+	size_t cells = 1;
+	while (cells < (size_t)capacity) cells <<= 1;  // Round up so positions map to cells with a mask
+	buffer->buffer = (buffer_cell_t *)aligned_alloc(CACHE_LINE, ((sizeof(buffer_cell_t) * cells + CACHE_LINE - 1) / CACHE_LINE) * CACHE_LINE);
+	if (buffer->buffer == NULL) {
+		perror("aligned_alloc");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < cells; i++) {
+		atomic_init(&buffer->buffer[i].seq, i);   // Cell i is free for the producer of position i
+	}
+	buffer->mask = cells - 1;
+	buffer->capacity = (int)cells;
+	atomic_init(&buffer->in, 0);
+	atomic_init(&buffer->out, 0);
+	atomic_init(&buffer->not_empty, 0);
+	atomic_init(&buffer->empty_waiters, 0);
+	atomic_init(&buffer->not_full, 0);
+	atomic_init(&buffer->full_waiters, 0);
+	atomic_init(&buffer->done, 0);   // Initialize the done flag
+}
+
+// Destroy the buffer
+void destroy_buffer(buffer_t *buffer) {
+	free(buffer->buffer);   // Free the buffer memory
+}
+
+// Wait until a claimed cell reaches the expected sequence; the thread that owns it is already
+// copying, so this only spins for the duration of one item copy unless that thread is preempted
+static void wait_for_cell(buffer_cell_t *cell, size_t seq) {
+	for (int spin = 0; atomic_load_explicit(&cell->seq, memory_order_acquire) != seq; spin++) {
+		if (spin < BUFFER_SPIN_LIMIT) {
+			cpu_relax();
+		} else {
+			sched_yield();
+		}
+	}
+}
+
+// Claim up to count free positions with one CAS and store the items; returns the number stored
+static int try_add(buffer_t *buffer, const file_info_t *items, int count) {
+	size_t capacity = buffer->mask + 1;
+	size_t pos = atomic_load_explicit(&buffer->in, memory_order_relaxed);
+	size_t claimed;
+	for (;;) {
+		size_t out = atomic_load_explicit(&buffer->out, memory_order_acquire);
+		if (out > pos) {    // Our view of in is stale
+			pos = atomic_load_explicit(&buffer->in, memory_order_relaxed);
+			continue;
+		}
+		size_t space = capacity - (pos - out);
+		if (space == 0) {
+			return 0;   // Full
+		}
+		claimed = (size_t)count < space ? (size_t)count : space;
+		if (atomic_compare_exchange_weak_explicit(&buffer->in, &pos, pos + claimed, memory_order_relaxed, memory_order_relaxed)) {
+			break;
+		}
+	}
+	for (size_t i = 0; i < claimed; i++) {
+		buffer_cell_t *cell = &buffer->buffer[(pos + i) & buffer->mask];
+		wait_for_cell(cell, pos + i);  // Consumer from the previous lap may still be reading
+		cell->data = items[i];
+		atomic_store_explicit(&cell->seq, pos + i + 1, memory_order_release);   // Hand the cell to consumers
+	}
+	return (int)claimed;
+}
+
+// Claim up to max queued positions with one CAS and load the items; returns the number loaded
+static int try_remove(buffer_t *buffer, file_info_t *items, int max) {
+	size_t pos = atomic_load_explicit(&buffer->out, memory_order_relaxed);
+	size_t claimed;
+	for (;;) {
+		size_t in = atomic_load_explicit(&buffer->in, memory_order_acquire);
+		if (in <= pos) {
+			if (in == pos) {
+				return 0;   // Empty
+			}
+			pos = atomic_load_explicit(&buffer->out, memory_order_relaxed);   // Our view of out is stale
+			continue;
+		}
+		claimed = (size_t)max < in - pos ? (size_t)max : in - pos;
+		if (atomic_compare_exchange_weak_explicit(&buffer->out, &pos, pos + claimed, memory_order_relaxed, memory_order_relaxed)) {
+			break;
+		}
+	}
+	for (size_t i = 0; i < claimed; i++) {
+		buffer_cell_t *cell = &buffer->buffer[(pos + i) & buffer->mask];
+		wait_for_cell(cell, pos + i + 1);  // Producer may still be writing the item
+		items[i] = cell->data;
+		atomic_store_explicit(&cell->seq, pos + i + buffer->mask + 1, memory_order_release);    // Free the cell for the next lap
+	}
+	return (int)claimed;
+}
+
+// Bump a futex word and wake sleepers if there are any
+static void signal_word(atomic_uint *word, atomic_int *waiters, int count) {
+	atomic_fetch_add(word, 1);
+	if (atomic_load(waiters) > 0) {
+		futex_wake(word, count);
+	}
+}
+
+// Add file information to the buffer
+void buffer_add(buffer_t *buffer, file_info_t *file_info) {
+	buffer_add_batch(buffer, file_info, 1);
+}
+
+// Add count items to the buffer, blocking while it is full
+void buffer_add_batch(buffer_t *buffer, file_info_t *items, int count) {
+	int spin = 0;
+	while (count > 0) {
+		unsigned word = atomic_load(&buffer->not_full);  // Read before retrying so a wakeup cannot be missed
+		int added = try_add(buffer, items, count);
+		if (added > 0) {
+			items += added;
+			count -= added;
+			spin = 0;
+			signal_word(&buffer->not_empty, &buffer->empty_waiters, added);    // Signal that the buffer is not empty
+			continue;
+		}
+		if (spin++ < BUFFER_SPIN_LIMIT) {
+			cpu_relax();
+			continue;
+		}
+		atomic_fetch_add(&buffer->full_waiters, 1);
+		added = try_add(buffer, items, count);
+		if (added == 0) {
+			futex_wait(&buffer->not_full, word);  // Sleep until a consumer frees a cell
+		}
+		atomic_fetch_sub(&buffer->full_waiters, 1);
+		if (added > 0) {
+			items += added;
+			count -= added;
+			spin = 0;
+			signal_word(&buffer->not_empty, &buffer->empty_waiters, added);
+		}
+	}
+}
+
+// Add up to count items without blocking; returns the number added, 0 while the buffer is full
+int buffer_try_add_batch(buffer_t *buffer, file_info_t *items, int count) {
+	int added = try_add(buffer, items, count);
+	if (added > 0) {
+		signal_word(&buffer->not_empty, &buffer->empty_waiters, added);
+	}
+	return added;
+}
+
+// Remove file information from the buffer
+int buffer_remove(buffer_t *buffer, file_info_t *file_info) {
+	return buffer_remove_batch(buffer, file_info, 1);
+}
+
+// Remove up to max items, blocking while the buffer is empty.
+// Returns the number removed, 0 once the buffer is drained and the manager is done.
+int buffer_remove_batch(buffer_t *buffer, file_info_t *items, int max) {
+	for (int spin = 0; ; spin++) {
+		int status = buffer_try_remove_batch(buffer, items, max);
+		if (status >= 0) return status;
+		unsigned word = atomic_load(&buffer->not_empty);
+		if (spin < BUFFER_SPIN_LIMIT) {
+			cpu_relax();
+			continue;
+		}
+		atomic_fetch_add(&buffer->empty_waiters, 1);
+		status = buffer_try_remove_batch(buffer, items, max);
+		if (status >= 0) {
+			atomic_fetch_sub(&buffer->empty_waiters, 1);
+			return status;
+		}
+		futex_wait(&buffer->not_empty, word);    // Sleep until a producer adds or the manager is done
+		atomic_fetch_sub(&buffer->empty_waiters, 1);
+	}
+}
+
+// Remove file information from the buffer without blocking.
+// Returns 1 when an item was removed, 0 when the buffer is drained and done, -1 when it is empty for now.
+int buffer_try_remove(buffer_t *buffer, file_info_t *file_info) {
+	return buffer_try_remove_batch(buffer, file_info, 1);
+}
+
+// Batch form of buffer_try_remove(): returns the number removed, 0 when drained and done, -1 when empty for now
+int buffer_try_remove_batch(buffer_t *buffer, file_info_t *items, int max) {
+	int done = atomic_load(&buffer->done);   // Read first: everything added before done is visible then
+	int removed = try_remove(buffer, items, max);
+	if (removed > 0) {
+		signal_word(&buffer->not_full, &buffer->full_waiters, 1);   // Signal that the buffer is not full
+		return removed;
+	}
+	return done ? 0 : -1;
+}
+
+// Mark the manager as done producing and wake every sleeping consumer
+void buffer_set_done(buffer_t *buffer) {
+	atomic_store(&buffer->done, 1);
+	signal_word(&buffer->not_empty, &buffer->empty_waiters, INT_MAX);
+}
+
+// Approximate number of queued items, for reporting only
+int buffer_count(buffer_t *buffer) {
+	size_t in = atomic_load_explicit(&buffer->in, memory_order_relaxed);
+	size_t out = atomic_load_explicit(&buffer->out, memory_order_relaxed);
+	return in > out ? (int)(in - out) : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "task.h"
+
+#define BUFFER_SPIN_LIMIT 128   // Polls before an idle thread parks on the futex
+#define CACHE_LINE 64           // Keeps hot producer and consumer fields apart
+
+// One ring slot; seq tells producers and consumers whose turn it is
+typedef struct {
+	atomic_size_t seq;          // pos when free for the producer of pos, pos + 1 when full
+	file_info_t data;           // Queued file information
+} buffer_cell_t;
+
+// Bounded multi-producer/multi-consumer ring storing file information for the workers.
+// Producers and consumers claim runs of positions with one CAS on in/out, so a batch costs a
+// single atomic operation; each cell's seq then tells the claimer when the cell is ready.
+// Threads that find the ring empty (or full) spin briefly, then sleep on a futex word that the
+// other side bumps on every change.
+typedef struct {
+	_Alignas(CACHE_LINE) atomic_size_t in;     // Next position to write (producers)
+	_Alignas(CACHE_LINE) atomic_size_t out;    // Next position to read (consumers)
+	_Alignas(CACHE_LINE) atomic_uint not_empty;    // Futex word bumped after every add and on done
+	atomic_int empty_waiters;   // Consumers sleeping on not_empty
+	_Alignas(CACHE_LINE) atomic_uint not_full;     // Futex word bumped after every remove
+	atomic_int full_waiters;    // Producers sleeping on not_full
+	_Alignas(CACHE_LINE) buffer_cell_t *buffer;   // Array of cells
+	size_t mask;                // capacity - 1
+	int capacity;               // Number of cells, capacity rounded up to a power of two
+	atomic_int done;            // Flag indicating if the manager is done producing
+} buffer_t;
+
+void init_buffer(buffer_t *buffer, int capacity);
+void destroy_buffer(buffer_t *buffer);
+void buffer_add(buffer_t *buffer, file_info_t *file_info);
+void buffer_add_batch(buffer_t *buffer, file_info_t *items, int count);
+int buffer_try_add_batch(buffer_t *buffer, file_info_t *items, int count);
+int buffer_remove(buffer_t *buffer, file_info_t *file_info);
+int buffer_remove_batch(buffer_t *buffer, file_info_t *items, int max);
+int buffer_try_remove(buffer_t *buffer, file_info_t *file_info);
+int buffer_try_remove_batch(buffer_t *buffer, file_info_t *items, int max);
+void buffer_set_done(buffer_t *buffer);
+int buffer_count(buffer_t *buffer);
+
+#endif //BUFFER_H
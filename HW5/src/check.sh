@@ -0,0 +1,67 @@
+#!/bin/sh
+# Regression checks for failure paths a plain copy never exercises. Each check builds a small
+# tree under CHECK_DIR, runs the copier on it and prints "ok" or "FAIL" with the reason; the
+# script exits non-zero when any check fails. Driven by "make check".
+set -eu
+
+BIN=${BIN:-./main}
+CHECK_DIR=${CHECK_DIR:-/tmp/hw5-check}
+
+failed=0
+
+fail() {
+	echo "FAIL: $1"
+	failed=1
+}
+
+# Make DIR refuse new entries: read-only mode, or the immutable flag for root, who ignores modes
+lock_dir() {
+	if [ "$(id -u)" -eq 0 ]; then
+		chattr +i "$1" 2> /dev/null
+	else
+		chmod 555 "$1"
+	fi
+}
+
+unlock_dir() {
+	if [ "$(id -u)" -eq 0 ]; then
+		chattr -i "$1"
+	else
+		chmod 755 "$1"
+	fi
+}
+
+# A destination directory that cannot be created: its subtree is skipped with one mkdirat
+# error, the rest of the tree is still copied, and the subtree stays out of the journal so
+# a resume copies it once the destination accepts it
+check_mkdirat() {
+	src=$CHECK_DIR/src
+	dst=$CHECK_DIR/dst
+	journal=$CHECK_DIR/journal
+	log=$CHECK_DIR/log
+	mkdir -p "$src/keep" "$src/locked/sub/deeper" "$dst/locked"
+	echo keep > "$src/keep/f"
+	echo sub > "$src/locked/sub/f"
+	echo deeper > "$src/locked/sub/deeper/f"
+	if ! lock_dir "$dst/locked"; then
+		echo "skip: mkdirat (cannot make $dst/locked read-only here)"
+		return
+	fi
+
+	"$BIN" --journal="$journal" 16 4 "$src" "$dst" > /dev/null 2> "$log" || true
+	unlock_dir "$dst/locked"
+	errors=$(grep -c '^mkdirat' "$log" || true)
+	[ "$errors" -eq 1 ] || fail "mkdirat: expected one mkdirat error, got $errors"
+	cmp -s "$src/keep/f" "$dst/keep/f" || fail "mkdirat: keep/f was not copied"
+	[ ! -e "$dst/locked/sub" ] || fail "mkdirat: locked/sub exists although it could not be created"
+
+	"$BIN" --journal="$journal" --resume 16 4 "$src" "$dst" > /dev/null 2> "$log" || true
+	diff -r "$src" "$dst" > /dev/null || fail "mkdirat: resume did not copy the skipped subtree"
+	[ "$failed" -ne 0 ] || echo "ok: mkdirat"
+}
+
+rm -rf "$CHECK_DIR"
+mkdir -p "$CHECK_DIR"
+check_mkdirat
+rm -rf "$CHECK_DIR"
+exit $failed
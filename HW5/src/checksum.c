@@ -0,0 +1,228 @@
+#include "checksum.h"
+#include <pthread.h>
+#include <string.h>
+
+// XXH64 constants
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define CRC32C_POLY 0x82F63B78U     // Castagnoli polynomial, bit-reflected
+
+static uint32_t crc32c_table[8][256];   // Slicing-by-8 tables for CPUs without the crc32 instruction
+static uint32_t crc32c_zero_block;      // CRC32C of CHECKSUM_BLOCK zero bytes, for holes
+static int crc32c_hardware;             // SSE4.2 crc32 instruction available
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));   // Unaligned-safe load, compiles to a plain mov
+	return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t val) {
+	acc ^= round64(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+// 64-bit XXH64 hash of a block (little-endian input order), used to compare blocks
+// without keeping both copies around
+uint64_t checksum64(const void *data, size_t len, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {    // Four independent lanes keep the multiplier pipelines busy
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+		const unsigned char *limit = end - 32;
+		do {
+			v1 = round64(v1, read64(p));
+			v2 = round64(v2, read64(p + 8));
+			v3 = round64(v3, read64(p + 16));
+			v4 = round64(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = merge64(h, v1);
+		h = merge64(h, v2);
+		h = merge64(h, v3);
+		h = merge64(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+	h += (uint64_t)len;
+
+	while (p + 8 <= end) {
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+// Unfinalised CRC32C update eight bytes at a time through the tables
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+	while (len >= 8) {
+		uint64_t v = read64(p) ^ crc;
+		crc = crc32c_table[7][v & 0xff] ^ crc32c_table[6][(v >> 8) & 0xff] ^
+				crc32c_table[5][(v >> 16) & 0xff] ^ crc32c_table[4][(v >> 24) & 0xff] ^
+				crc32c_table[3][(v >> 32) & 0xff] ^ crc32c_table[2][(v >> 40) & 0xff] ^
+				crc32c_table[1][(v >> 48) & 0xff] ^ crc32c_table[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len-- > 0) {
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+// Same update with the SSE4.2 crc32 instruction, eight bytes per instruction
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+	uint64_t c = crc;
+	while (len >= 8) {
+		c = __builtin_ia32_crc32di(c, read64(p));
+		p += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)c;
+	while (len-- > 0) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	}
+	return crc;
+}
+#endif
+
+static inline uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+#if defined(__x86_64__)
+	if (crc32c_hardware) return ~crc32c_hw(~crc, (const unsigned char *)data, len);
+#endif
+	return ~crc32c_sw(~crc, (const unsigned char *)data, len);
+}
+
+static void crc32c_init(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		}
+		crc32c_table[0][i] = crc;
+	}
+	for (int i = 0; i < 256; i++) {
+		for (int t = 1; t < 8; t++) {
+			crc32c_table[t][i] = crc32c_table[0][crc32c_table[t - 1][i] & 0xff] ^ (crc32c_table[t - 1][i] >> 8);
+		}
+	}
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+	static const unsigned char zeros[CHECKSUM_BLOCK];
+	crc32c_zero_block = crc32c_update(0, zeros, sizeof(zeros));
+}
+
+// CRC32C of data continuing from crc (0 to start), hardware accelerated where available
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+	pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_update(crc, data, len);
+}
+
+// Spread a block's CRC and index over all 64 bits (XXH64 avalanche) before it is summed
+static inline uint64_t block_mix(uint32_t crc, long long index) {
+	uint64_t h = ((uint64_t)index << 32 | crc) * PRIME64_1;
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+// Start a range at offset, which must be a multiple of CHECKSUM_BLOCK
+void checksum_stream_begin(checksum_stream_t *stream, long long offset) {
+	pthread_once(&crc32c_once, crc32c_init);
+	stream->digest = 0;
+	stream->crc = 0;
+	stream->offset = offset;
+}
+
+void checksum_stream_update(checksum_stream_t *stream, const void *data, size_t len) {
+	const unsigned char *p = (const unsigned char *)data;
+	while (len > 0) {
+		size_t room = CHECKSUM_BLOCK - (size_t)(stream->offset % CHECKSUM_BLOCK);
+		size_t take = len < room ? len : room;
+		stream->crc = crc32c_update(stream->crc, p, take);
+		stream->offset += (long long)take;
+		p += take;
+		len -= take;
+		if (take == room) {     // Block complete
+			stream->digest += block_mix(stream->crc, stream->offset / CHECKSUM_BLOCK - 1);
+			stream->crc = 0;
+		}
+	}
+}
+
+// Feed len zero bytes of a hole; whole blocks use the precomputed CRC
+void checksum_stream_zeros(checksum_stream_t *stream, long long len) {
+	static const unsigned char zeros[CHECKSUM_BLOCK];
+	while (len > 0) {
+		long long room = CHECKSUM_BLOCK - stream->offset % CHECKSUM_BLOCK;
+		if (room == CHECKSUM_BLOCK && len >= CHECKSUM_BLOCK) {
+			stream->digest += block_mix(crc32c_zero_block, stream->offset / CHECKSUM_BLOCK);
+			stream->offset += CHECKSUM_BLOCK;
+			len -= CHECKSUM_BLOCK;
+		} else {
+			size_t take = (size_t)(len < room ? len : room);
+			checksum_stream_update(stream, zeros, take);
+			len -= (long long)take;
+		}
+	}
+}
+
+// Digest of the range; a partial last block is only possible at end of file
+uint64_t checksum_stream_end(checksum_stream_t *stream) {
+	if (stream->offset % CHECKSUM_BLOCK != 0) {
+		stream->digest += block_mix(stream->crc, stream->offset / CHECKSUM_BLOCK);
+		stream->crc = 0;
+	}
+	return stream->digest;
+}
@@ -0,0 +1,25 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKSUM_BLOCK (64 * 1024)     // Block size of the verify digest; chunk boundaries must be multiples
+
+// Verify digest of a byte range fed in file order. Every CHECKSUM_BLOCK block at index i
+// contributes mix(CRC32C(block), i) to a sum, so digests of disjoint ranges starting on
+// block boundaries add up to the digest of the whole file, whatever order they finish in.
+typedef struct {
+	uint64_t digest;            // Sum over the finished blocks
+	uint32_t crc;               // CRC32C of the current block so far
+	long long offset;           // File offset of the next byte
+} checksum_stream_t;
+
+uint64_t checksum64(const void *data, size_t len, uint64_t seed);
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+void checksum_stream_begin(checksum_stream_t *stream, long long offset);
+void checksum_stream_update(checksum_stream_t *stream, const void *data, size_t len);
+void checksum_stream_zeros(checksum_stream_t *stream, long long len);
+uint64_t checksum_stream_end(checksum_stream_t *stream);
+
+#endif //CHECKSUM_H
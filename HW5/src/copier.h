@@ -0,0 +1,106 @@
+#ifndef COPIER_H
+#define COPIER_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include "buffer.h"
+#include "copy_engine.h"
+#include "dedup.h"
+#include "devices.h"
+#include "fanout.h"
+#include "journal.h"
+#include "links.h"
+#include "meta.h"
+#include "plan.h"
+#include "pool.h"
+#include "progress.h"
+#include "schedule.h"
+#include "tar.h"
+#include "stats.h"
+#include "verify.h"
+
+#define SPLIT_DEFAULT_THRESHOLD (1LL << 30)     // Files larger than this are copied in chunks
+#define SPLIT_DEFAULT_CHUNK (256LL << 20)       // Bytes per chunk of a split file
+#define TASK_BATCH_DEFAULT 16   // Tasks moved per buffer claim by walkers and workers
+#define TASK_BATCH_MAX 256      // Upper bound for --batch
+#define DELTA_DEFAULT_BLOCK (128LL << 10)       // Delta mode block size
+
+// Completion state shared by the chunks of one split file
+typedef struct chunked_file {
+	atomic_int chunks_left;     // Chunks not finished yet, the file is done at 0
+	atomic_int failed;          // Set if any chunk failed
+	atomic_llong bytes;         // Bytes written by all chunks
+	atomic_llong skipped;       // Bytes found unchanged by all chunks
+	atomic_llong start_ns;      // Earliest start of any chunk, for the file's latency
+	atomic_ullong digest;       // Verify mode: sum of the chunks' source digests
+	atomic_ullong failed_dests; // Fan-out: destinations any chunk failed to write
+} chunked_file_t;
+
+// Parameters and statistics shared by the manager and worker threads
+typedef struct thread_params {
+	buffer_t *buffer;           // Shared buffer between manager and workers
+	int buffer_size;            // Size of the buffer
+	int num_workers;            // Number of worker threads (the upper bound in auto mode)
+	worker_pool_t *pool;        // Auto mode pool sizing, NULL for a fixed worker count
+	int num_walkers;            // Number of directory traversal threads
+	char src_dir[MAX_PATH];     // Source directory path
+	char dst_dir[MAX_PATH];     // Destination directory path
+	atomic_int regular_files;   // Number of regular files copied
+	atomic_int fifo_files;      // Number of FIFO files copied
+	atomic_int directories;     // Number of directories copied
+	atomic_int hardlinks;       // Names linked to an already copied inode instead of copied
+	atomic_int symlinks;        // Symbolic links recreated
+	worker_stats_t *worker_stats;   // One shard per worker: files, bytes, backends, timing
+	copy_engine_t engine;       // Copy backend selected on the command line
+	int direct;                 // O_DIRECT copies through aligned per-worker buffers
+	int drop_cache;             // Buffered copies drop their pages from the cache when done
+	int verbose;                // Report the backend used for every file
+	int uring_depth;            // io_uring queue depth per worker, 0 for blocking workers
+	long long split_threshold;  // Files above this size are split, 0 disables splitting
+	long long chunk_size;       // Bytes per chunk of a split file
+	int batch_size;             // Tasks added or removed per buffer claim
+	int stat_files;             // Walkers stat regular files, else the workers link and split them (defer_task)
+	int sync;                   // Skip files whose destination is unchanged
+	int checksum;               // Sync compares contents instead of size and mtime
+	int delete_extraneous;      // Sync removes destination entries missing from the source
+	long long delta_block;      // Delta mode block size, 0 when disabled
+	atomic_int skipped_files;   // Files left alone by sync without queuing them
+	atomic_llong skipped_bytes; // Bytes of those files
+	atomic_int deleted_entries; // Destination entries removed by sync
+	journal_t *journal;         // Checkpoint journal, NULL when not journaling
+	dedup_t *dedup;             // Content hash table linking duplicate files, NULL when disabled
+	inode_map_t *inodes;        // First copy of every source inode with several links
+	sched_t *sched;             // Largest-first ordering of queued tasks, NULL for FIFO
+	devices_t *devices;         // Per-device queues with in-flight limits, NULL for one shared queue
+	meta_t *meta;               // Applies mode, owner, xattrs and times after the data, NULL when not preserving
+	tar_t *tar;                 // Archive the tree instead of copying it, NULL for a directory copy
+	plan_t *plan;               // Dry run: only size the tree, NULL for a copy
+	verify_t *verify;           // Copied files to re-read and compare afterwards, NULL when not verifying
+	fanout_t *fanout;           // Further destinations written from the same reads, NULL for one destination
+	atomic_int resumed_files;   // Files the interrupted run had finished, not queued again
+	atomic_int resumed_dirs;    // Finished subtrees not walked again
+	atomic_llong found_files;   // Files queued by the walkers so far
+	atomic_llong found_bytes;   // Bytes of the queued tasks, what the ETA counts down
+	atomic_int walk_done;       // The walkers finished, found_* are final
+	pthread_mutex_t output_mutex;  // Mutex for synchronizing output
+	pthread_barrier_t barrier;  // Barrier for synchronizing worker threads
+} thread_params_t;
+
+// Argument of each worker thread
+typedef struct {
+	thread_params_t *params;    // Shared thread parameters
+	int id;                     // Index in params->worker_stats
+	worker_stats_t *stats;      // This worker's counters
+	copy_ctx_t copy;            // Copy settings and this worker's slice of the buffer pool
+	checksum_stream_t hash;     // Verify mode: digest of the task being copied, copy.hash points here
+} worker_t;
+
+void *manager_thread(void *arg);
+void *worker_thread(void *arg);
+void record_copy(worker_t *worker, const file_info_t *file_info, int status, const copy_result_t *result, long long start_ns);
+void drop_task(const file_info_t *file_info);
+
+extern volatile sig_atomic_t termination_flag;
+
+#endif //COPIER_H
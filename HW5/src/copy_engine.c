@@ -0,0 +1,828 @@
+#define _GNU_SOURCE
+#include "copy_engine.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define KERNEL_CHUNK (1L << 30)     // Bytes requested per copy_file_range/sendfile call
+#define SPLICE_PIPE_SIZE (1 << 20)  // Pipe capacity requested for the splice path
+#define COMPARE_BLOCK (64 * 1024)   // Smallest block read when comparing source and destination
+
+// Result of a single backend attempt
+enum {
+	STEP_DONE = 0,      // Source reached EOF
+	STEP_FALLBACK = 1,  // Backend not usable for this pair of descriptors, try the next one
+	STEP_ERROR = -1     // Real I/O error, errno is set
+};
+
+static const char *method_names[COPY_METHOD_COUNT] = {
+	"copy_file_range", "sendfile", "splice", "read/write", "io_uring", "direct", "clone", "link", "tar"
+};
+
+// Map a command line engine name to its enum value
+int parse_copy_engine(const char *name, copy_engine_t *engine) {
+	if (strcmp(name, "auto") == 0) {
+		*engine = ENGINE_AUTO;
+	} else if (strcmp(name, "copy_file_range") == 0) {
+		*engine = ENGINE_COPY_FILE_RANGE;
+	} else if (strcmp(name, "sendfile") == 0) {
+		*engine = ENGINE_SENDFILE;
+	} else if (strcmp(name, "splice") == 0) {
+		*engine = ENGINE_SPLICE;
+	} else if (strcmp(name, "rw") == 0 || strcmp(name, "read/write") == 0) {
+		*engine = ENGINE_READ_WRITE;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+const char *copy_method_name(copy_method_t method) {
+	return method < COPY_METHOD_COUNT ? method_names[method] : "none";
+}
+
+// Errors meaning "this syscall cannot handle these descriptors", not "the copy failed"
+static int is_fallback_errno(int err) {
+	return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == EBADF;
+}
+
+// Write all len bytes of buf to fd, retrying short writes
+static int write_all(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, buf, len);
+		if (written == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		buf += written;
+		len -= (size_t)written;
+	}
+	return 0;
+}
+
+// In-kernel copy between two files, both file offsets advance
+static int step_copy_file_range(int src_fd, int dst_fd, long long *bytes) {
+	long long start = *bytes;
+	for (;;) {
+		ssize_t n = copy_file_range(src_fd, NULL, dst_fd, NULL, KERNEL_CHUNK, 0);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return (*bytes == start && is_fallback_errno(errno)) ? STEP_FALLBACK : STEP_ERROR;
+		}
+		if (n == 0) {
+			// Pseudo filesystems (procfs, sysfs) report 0 instead of failing, let read() decide
+			return *bytes == start ? STEP_FALLBACK : STEP_DONE;
+		}
+		*bytes += n;
+	}
+}
+
+// Page cache to file copy, source offset advances through the descriptor
+static int step_sendfile(int src_fd, int dst_fd, long long *bytes) {
+	long long start = *bytes;
+	for (;;) {
+		ssize_t n = sendfile(dst_fd, src_fd, NULL, KERNEL_CHUNK);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return (*bytes == start && is_fallback_errno(errno)) ? STEP_FALLBACK : STEP_ERROR;
+		}
+		if (n == 0) {
+			return *bytes == start ? STEP_FALLBACK : STEP_DONE;
+		}
+		*bytes += n;
+	}
+}
+
+// Drain whatever is left in the pipe with ordinary reads and writes
+static int drain_pipe(int pipe_fd, int dst_fd, size_t pending, long long *bytes) {
+	char buffer[4096];
+	while (pending > 0) {
+		ssize_t n = read(pipe_fd, buffer, pending < sizeof(buffer) ? pending : sizeof(buffer));
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR) continue;
+			return -1;
+		}
+		if (write_all(dst_fd, buffer, (size_t)n) == -1) return -1;
+		pending -= (size_t)n;
+		*bytes += n;
+	}
+	return 0;
+}
+
+// Move pages file -> pipe -> file without copying them into user space
+static int step_splice(int src_fd, int dst_fd, long long *bytes) {
+	int pipe_fds[2];
+	if (pipe(pipe_fds) == -1) {
+		return STEP_FALLBACK;
+	}
+	fcntl(pipe_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);   // Best effort, default size still works
+
+	long long start = *bytes;
+	int status = STEP_DONE;
+	for (;;) {
+		ssize_t in = splice(src_fd, NULL, pipe_fds[1], NULL, SPLICE_PIPE_SIZE, SPLICE_F_MOVE);
+		if (in == -1) {
+			if (errno == EINTR) continue;
+			status = (*bytes == start && is_fallback_errno(errno)) ? STEP_FALLBACK : STEP_ERROR;
+			break;
+		}
+		if (in == 0) {
+			if (*bytes == start) status = STEP_FALLBACK;    // Same reasoning as copy_file_range
+			break;
+		}
+		size_t pending = (size_t)in;
+		while (pending > 0) {
+			ssize_t out = splice(pipe_fds[0], NULL, dst_fd, NULL, pending, SPLICE_F_MOVE);
+			if (out == -1) {
+				if (errno == EINTR) continue;
+				// Destination refuses splice (e.g. O_APPEND), finish this pipe load by hand
+				if (is_fallback_errno(errno) && drain_pipe(pipe_fds[0], dst_fd, pending, bytes) == 0) {
+					pending = 0;
+					status = STEP_FALLBACK;
+					break;
+				}
+				status = STEP_ERROR;
+				break;
+			}
+			pending -= (size_t)out;
+			*bytes += out;
+		}
+		if (status != STEP_DONE) break;
+	}
+
+	int saved_errno = errno;
+	close(pipe_fds[0]);
+	close(pipe_fds[1]);
+	errno = saved_errno;
+	return status;
+}
+
+// Bytes per read() in the user-space loops: buffer_size, or the whole buffer when the bytes are
+// also hashed, so verify mode costs one checksum call per large read rather than per small one
+static size_t copy_chunk(const copy_ctx_t *ctx) {
+	if (ctx->hash != NULL || (size_t)ctx->buffer_size > ctx->buf_size) return ctx->buf_size;
+	return (size_t)ctx->buffer_size;
+}
+
+// Classic user-space copy through the worker's buffer, always works. Verify mode forces this
+// path (or the direct one) so every source byte passes through ctx->buf and is hashed there.
+static int step_read_write(int src_fd, int dst_fd, copy_ctx_t *ctx, long long *bytes) {
+	size_t chunk = copy_chunk(ctx);
+	ssize_t bytes_read;
+	while ((bytes_read = read(src_fd, ctx->buf, chunk)) != 0) {  // Read from the source file
+		if (bytes_read == -1) {
+			if (errno == EINTR) continue;
+			return STEP_ERROR;
+		}
+		if (ctx->hash != NULL) {
+			checksum_stream_update(ctx->hash, ctx->buf, (size_t)bytes_read);   // Source hashed while it is in the buffer
+		}
+		if (write_all(dst_fd, ctx->buf, (size_t)bytes_read) == -1) {  // Write to the destination file
+			return STEP_ERROR;
+		}
+		*bytes += bytes_read;
+	}
+	return STEP_DONE;
+}
+
+static int run_step(copy_method_t method, int src_fd, int dst_fd, copy_ctx_t *ctx, long long *bytes) {
+	switch (method) {
+		case COPY_METHOD_COPY_FILE_RANGE: return step_copy_file_range(src_fd, dst_fd, bytes);
+		case COPY_METHOD_SENDFILE:        return step_sendfile(src_fd, dst_fd, bytes);
+		case COPY_METHOD_SPLICE:          return step_splice(src_fd, dst_fd, bytes);
+		default:                          return step_read_write(src_fd, dst_fd, ctx, bytes);
+	}
+}
+
+// Bytes each worker's buffer needs: buffer_size for buffered copies, at least
+// COPY_DIRECT_MIN for direct ones and for those that stream every byte through the buffer
+// (large), rounded up to COPY_IO_ALIGN either way
+size_t copy_buffer_size(int buffer_size, int large) {
+	size_t size = buffer_size > 0 ? (size_t)buffer_size : 1;
+	if (large && size < COPY_DIRECT_MIN) {
+		size = COPY_DIRECT_MIN;
+	}
+	return (size + COPY_IO_ALIGN - 1) / COPY_IO_ALIGN * COPY_IO_ALIGN;
+}
+
+// Buffered mode with drop_cache: write the copied range back and drop it from the page cache
+// on both sides, so a bulk copy does not push the hot working set out
+static void drop_cached(copy_ctx_t *ctx, int src_fd, int dst_fd, off_t offset, off_t length) {
+	if (!ctx->drop_cache) return;
+	sync_file_range(dst_fd, offset, length, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	posix_fadvise(dst_fd, offset, length, POSIX_FADV_DONTNEED);     // Only clean pages can be dropped
+	posix_fadvise(src_fd, offset, length, POSIX_FADV_DONTNEED);
+}
+
+// O_DIRECT copy of [offset, offset + length) through the worker's aligned buffer. Transfers
+// are buf_size bytes at aligned offsets; the unaligned tail at end of file is written with
+// O_DIRECT cleared on the destination. Returns STEP_FALLBACK before moving any byte if the
+// filesystem rejects direct I/O, leaving both descriptors buffered.
+static int copy_range_direct(int src_fd, int dst_fd, off_t offset, off_t length, copy_ctx_t *ctx, long long *bytes) {
+	off_t end = offset + length;
+	off_t pos = offset;
+	while (pos < end) {
+		size_t want = end - pos < (off_t)ctx->buf_size ? (size_t)(end - pos) : ctx->buf_size;
+		size_t aligned = (want + COPY_IO_ALIGN - 1) / COPY_IO_ALIGN * COPY_IO_ALIGN;   // Reads past EOF just come back short
+		ssize_t n = pread(src_fd, ctx->buf, aligned, pos);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && errno == EINVAL && pos == offset) goto fallback;
+		if (n == -1) return STEP_ERROR;
+		if (n == 0) break;      // Source shrank
+		if ((size_t)n > want) n = (ssize_t)want;    // Chunk ends before EOF
+		size_t body = (size_t)n / COPY_IO_ALIGN * COPY_IO_ALIGN;
+		for (size_t done = 0; done < body; ) {
+			ssize_t written = pwrite(dst_fd, ctx->buf + done, body - done, pos + (off_t)done);
+			if (written == -1 && errno == EINTR) continue;
+			if (written == -1 && errno == EINVAL && pos == offset && done == 0) goto fallback;
+			if (written == -1) return STEP_ERROR;
+			done += (size_t)written;
+		}
+		if (body < (size_t)n) {     // Unaligned tail, only possible at end of file
+			int flags = fcntl(dst_fd, F_GETFL);
+			if (flags == -1 || fcntl(dst_fd, F_SETFL, flags & ~O_DIRECT) == -1) return STEP_ERROR;
+			for (size_t done = body; done < (size_t)n; ) {
+				ssize_t written = pwrite(dst_fd, ctx->buf + done, (size_t)n - done, pos + (off_t)done);
+				if (written == -1 && errno == EINTR) continue;
+				if (written == -1) return STEP_ERROR;
+				done += (size_t)written;
+			}
+			fcntl(dst_fd, F_SETFL, flags);
+		}
+		if (ctx->hash != NULL) {
+			checksum_stream_update(ctx->hash, ctx->buf, (size_t)n);     // After the writes, a fallback rereads the first block
+		}
+		pos += n;
+		*bytes += n;
+		if ((size_t)n < want) break;    // Short read, end of file
+	}
+	return STEP_DONE;
+
+fallback:
+	fcntl(src_fd, F_SETFL, fcntl(src_fd, F_GETFL) & ~O_DIRECT);
+	fcntl(dst_fd, F_SETFL, fcntl(dst_fd, F_GETFL) & ~O_DIRECT);
+	return STEP_FALLBACK;
+}
+
+// Open flags adding O_DIRECT in direct mode
+static int open_direct(const char *path, int flags, int direct) {
+	if (direct) {
+		int fd = open(path, flags | O_DIRECT, 0644);
+		if (fd != -1 || errno != EINVAL) return fd;     // EINVAL: filesystem has no direct I/O
+	}
+	return open(path, flags, 0644);
+}
+
+// Reflink [offset, offset + length) of src_fd into dst_fd at the same offset, sharing the
+// extents on copy-on-write filesystems (btrfs, XFS, bcachefs). A length of 0 clones the whole
+// file. Returns 0 on success, -1 if the filesystem cannot clone this pair (different
+// filesystems, no reflink support, unaligned range); nothing was written then.
+int copy_clone(int src_fd, int dst_fd, off_t offset, off_t length) {
+	if (offset == 0 && length == 0) {
+		return ioctl(dst_fd, FICLONE, src_fd) == 0 ? 0 : -1;
+	}
+	struct file_clone_range range = {.src_fd = src_fd, .src_offset = (__u64)offset, .src_length = (__u64)length, .dest_offset = (__u64)offset};
+	return ioctl(dst_fd, FICLONERANGE, &range) == 0 ? 0 : -1;
+}
+
+// Whole-file reflink for the auto engine, skipped for source devices that already refused one.
+// The destination is a single tree, so the source device stands for the device pair; a
+// refusal that holds for the whole pair (different filesystems, no reflink support) is
+// remembered in this worker's context, so a non-CoW copy pays one failed ioctl per worker.
+static int clone_file(copy_ctx_t *ctx, const struct stat *src_st, int src_fd, int dst_fd) {
+	for (int i = 0; i < ctx->no_clone_count; i++) {
+		if (ctx->no_clone[i] == src_st->st_dev) return -1;
+	}
+	if (copy_clone(src_fd, dst_fd, 0, 0) == 0) return 0;
+	if ((errno == EXDEV || errno == EOPNOTSUPP || errno == ENOTTY || errno == ENOSYS || errno == EINVAL) &&
+			ctx->no_clone_count < COPY_CLONE_CACHE) {
+		ctx->no_clone[ctx->no_clone_count++] = src_st->st_dev;
+	}
+	return -1;
+}
+
+// Copy src_fd to dst_fd starting at their current offsets.
+// Backends are tried in order copy_file_range -> sendfile -> splice -> read/write, beginning
+// with the one selected by engine. Every backend advances the file offsets, so a fallback
+// resumes exactly where the previous backend stopped.
+int copy_fd(int src_fd, int dst_fd, copy_ctx_t *ctx, copy_result_t *result) {
+	copy_method_t first = COPY_METHOD_COPY_FILE_RANGE;
+	switch (ctx->engine) {
+		case ENGINE_SENDFILE:   first = COPY_METHOD_SENDFILE; break;
+		case ENGINE_SPLICE:     first = COPY_METHOD_SPLICE; break;
+		case ENGINE_READ_WRITE: first = COPY_METHOD_READ_WRITE; break;
+		default: break;
+	}
+
+	result->bytes = 0;
+	result->skipped = 0;
+	result->holes = 0;
+	result->deduped = 0;
+	result->method = first;
+	for (copy_method_t method = first; method <= COPY_METHOD_READ_WRITE; method++) {
+		long long before = result->bytes;
+		int status = run_step(method, src_fd, dst_fd, ctx, &result->bytes);
+		if (result->bytes != before || status == STEP_DONE) {
+			result->method = method;    // Remember the backend that finished the file
+		}
+		if (status == STEP_DONE) return 0;
+		if (status == STEP_ERROR) return -1;
+	}
+	return 0;
+}
+
+// Copy file from source to destination. Returns COPY_DEFER without touching dst when the
+// walkers left the file unstat'ed and it turns out to need a link or a split (see defer_*).
+int copy_file(const char *src, const char *dst, copy_ctx_t *ctx, copy_result_t *result) {
+	int src_fd = open_direct(src, O_RDONLY, ctx->direct);    // Open source file for reading
+	if (src_fd == -1) {
+		perror("open src");
+		return -1;
+	}
+	struct stat st;
+	if (fstat(src_fd, &st) == -1) {
+		perror("fstat");
+		close(src_fd);
+		return -1;
+	}
+	if ((ctx->defer_links && st.st_nlink > 1) || (ctx->defer_above > 0 && st.st_size > ctx->defer_above)) {
+		close(src_fd);
+		return COPY_DEFER;
+	}
+	int dst_fd = open_direct(dst, O_WRONLY | O_CREAT | O_TRUNC, ctx->direct);   // Open destination file for writing
+	if (dst_fd == -1) {
+		perror("open dst");
+		close(src_fd);
+		return -1;
+	}
+
+	int status;
+	int direct = (fcntl(src_fd, F_GETFL) & O_DIRECT) && (fcntl(dst_fd, F_GETFL) & O_DIRECT);
+	if (ctx->direct && !direct) {   // Only one side opened with O_DIRECT, copy both buffered
+		fcntl(src_fd, F_SETFL, fcntl(src_fd, F_GETFL) & ~O_DIRECT);
+		fcntl(dst_fd, F_SETFL, fcntl(dst_fd, F_GETFL) & ~O_DIRECT);
+	}
+	if (ctx->engine == ENGINE_AUTO && st.st_size > 0 && clone_file(ctx, &st, src_fd, dst_fd) == 0) {  // Same CoW filesystem: no data moves
+		result->bytes = st.st_size;
+		result->skipped = 0;
+		result->holes = 0;
+		result->deduped = 0;
+		result->method = COPY_METHOD_CLONE;
+		status = 0;
+	} else if (copy_is_sparse(&st)) {      // Holes stay holes: size the file, then fill in the data extents
+		status = ftruncate(dst_fd, st.st_size) == -1 ? -1 : copy_data_extents(src_fd, dst_fd, 0, st.st_size, ctx, result);
+	} else {
+		if (st.st_size >= COPY_PREALLOC_MIN) {   // One reservation instead of growing write by write, best effort
+			fallocate(dst_fd, FALLOC_FL_KEEP_SIZE, 0, st.st_size);
+		}
+		if (direct) {
+			result->bytes = 0;
+			result->skipped = 0;
+			result->holes = 0;
+			result->deduped = 0;
+			result->method = COPY_METHOD_DIRECT;
+			status = copy_range_direct(src_fd, dst_fd, 0, st.st_size, ctx, &result->bytes);
+			if (status == STEP_FALLBACK) {
+				status = copy_fd(src_fd, dst_fd, ctx, result);  // Offsets are still 0
+			} else {
+				status = status == STEP_DONE ? 0 : -1;
+			}
+		} else {
+			status = copy_fd(src_fd, dst_fd, ctx, result);
+			if (status == 0) {
+				drop_cached(ctx, src_fd, dst_fd, 0, 0);
+			}
+		}
+	}
+	if (status == -1) {
+		perror("copy");
+	}
+	close(src_fd);    // Close source file
+	close(dst_fd);    // Close destination file
+	return status;
+}
+
+// Copy length bytes at offset from src_fd to the same offset of dst_fd without touching the
+// file offsets, so several workers can fill disjoint ranges of one file at the same time.
+// copy_file_range() with explicit offsets is used unless the read/write engine was requested;
+// whatever it refuses is finished with pread()/pwrite().
+int copy_range(int src_fd, int dst_fd, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result) {
+	off_t in_offset = offset;   // Next source byte
+	off_t out_offset = offset;  // Next destination byte
+	off_t end = offset + length;
+	result->bytes = 0;
+	result->skipped = 0;
+	result->holes = 0;
+	result->deduped = 0;
+	result->method = COPY_METHOD_COPY_FILE_RANGE;
+
+	if ((fcntl(src_fd, F_GETFL) & O_DIRECT) && (fcntl(dst_fd, F_GETFL) & O_DIRECT)) {
+		result->method = COPY_METHOD_DIRECT;
+		int status = offset % COPY_IO_ALIGN == 0 ? copy_range_direct(src_fd, dst_fd, offset, length, ctx, &result->bytes) : STEP_FALLBACK;
+		if (status != STEP_FALLBACK) return status == STEP_DONE ? 0 : -1;
+		fcntl(src_fd, F_SETFL, fcntl(src_fd, F_GETFL) & ~O_DIRECT);     // Unaligned chunk, copy it buffered
+		fcntl(dst_fd, F_SETFL, fcntl(dst_fd, F_GETFL) & ~O_DIRECT);
+		result->method = COPY_METHOD_COPY_FILE_RANGE;
+	}
+
+	if (ctx->engine == ENGINE_AUTO || ctx->engine == ENGINE_COPY_FILE_RANGE) {
+		while (in_offset < end) {
+			off_t want = end - in_offset < KERNEL_CHUNK ? end - in_offset : KERNEL_CHUNK;
+			ssize_t n = copy_file_range(src_fd, &in_offset, dst_fd, &out_offset, (size_t)want, 0);
+			if (n == -1 && errno == EINTR) continue;
+			if (n == -1 && !is_fallback_errno(errno)) return -1;
+			if (n <= 0) break;  // Refused or source shorter than expected
+			result->bytes += n;
+		}
+		if (in_offset >= end) {
+			drop_cached(ctx, src_fd, dst_fd, offset, length);
+			return 0;
+		}
+	}
+
+	result->method = COPY_METHOD_READ_WRITE;
+	size_t chunk = copy_chunk(ctx);
+	while (in_offset < end) {
+		size_t want = end - in_offset < (off_t)chunk ? (size_t)(end - in_offset) : chunk;
+		ssize_t bytes_read = pread(src_fd, ctx->buf, want, in_offset);  // Read from the source file
+		if (bytes_read == -1 && errno == EINTR) continue;
+		if (bytes_read == -1) return -1;
+		if (bytes_read == 0) break;     // The source shrank
+		if (ctx->hash != NULL) {
+			checksum_stream_update(ctx->hash, ctx->buf, (size_t)bytes_read);
+		}
+		for (ssize_t done = 0; done < bytes_read; ) {
+			ssize_t written = pwrite(dst_fd, ctx->buf + done, (size_t)(bytes_read - done), in_offset + done);  // Write to the destination file
+			if (written == -1) {
+				if (errno == EINTR) continue;
+				return -1;
+			}
+			done += written;
+		}
+		in_offset += bytes_read;
+		result->bytes += bytes_read;
+	}
+	drop_cached(ctx, src_fd, dst_fd, offset, length);
+	return 0;
+}
+
+// Allocated space below the size means the file has holes
+int copy_is_sparse(const struct stat *st) {
+	return (long long)st->st_blocks * 512 < (long long)st->st_size;
+}
+
+// Copy only the data extents of [offset, offset + length) found with SEEK_DATA/SEEK_HOLE,
+// reserving each destination extent with fallocate first. Holes are never written, so the
+// destination (already sized by the caller) keeps them. Filesystems without SEEK_DATA
+// report the whole file as data. With ctx->hash the holes are hashed as the zeros they read as.
+int copy_data_extents(int src_fd, int dst_fd, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result) {
+	off_t end = offset + length;
+	off_t pos = offset;
+	result->bytes = 0;
+	result->skipped = 0;
+	result->holes = 0;
+	result->deduped = 0;
+	result->method = COPY_METHOD_COPY_FILE_RANGE;
+	while (pos < end) {
+		off_t data = lseek(src_fd, pos, SEEK_DATA);
+		if (data == -1 && errno == ENXIO) data = end;   // Only a hole is left
+		if (data == -1) return -1;
+		if (data > end) data = end;
+		result->holes += data - pos;
+		if (ctx->hash != NULL) {
+			checksum_stream_zeros(ctx->hash, data - pos);   // Holes read back as zeros
+		}
+		if (data == end) break;
+		off_t hole = lseek(src_fd, data, SEEK_HOLE);
+		if (hole == -1) return -1;
+		if (hole > end) hole = end;
+		fallocate(dst_fd, FALLOC_FL_KEEP_SIZE, data, hole - data);  // Best effort, keeps the extent contiguous
+		copy_result_t part;
+		int status = copy_range(src_fd, dst_fd, data, hole - data, ctx, &part);
+		result->bytes += part.bytes;
+		result->method = part.method;
+		if (status == -1) return -1;
+		if (part.bytes < hole - data) break;    // Source shrank
+		pos = hole;
+	}
+	return 0;
+}
+
+// Copy one chunk of a split file into the sized destination, skipping holes
+int copy_file_part(const char *src, const char *dst, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result) {
+	result->bytes = 0;
+	result->skipped = 0;
+	result->holes = 0;
+	result->deduped = 0;
+	result->method = COPY_METHOD_READ_WRITE;
+	int src_fd = open_direct(src, O_RDONLY, ctx->direct);    // Open source file for reading
+	if (src_fd == -1) {
+		perror("open src");
+		return -1;
+	}
+	int dst_fd = open_direct(dst, O_WRONLY, ctx->direct);    // Destination was created and sized by the traversal
+	if (dst_fd == -1) {
+		perror("open dst");
+		close(src_fd);
+		return -1;
+	}
+
+	int status;
+	if (ctx->engine == ENGINE_AUTO && length > 0 && copy_clone(src_fd, dst_fd, offset, length) == 0) {
+		result->bytes = length;     // Chunk offsets are multiples of the chunk size, so block aligned
+		result->method = COPY_METHOD_CLONE;
+		status = 0;
+	} else {
+		status = copy_data_extents(src_fd, dst_fd, offset, length, ctx, result);
+	}
+	if (status == -1) {
+		perror("copy");
+	}
+	close(src_fd);    // Close source file
+	close(dst_fd);    // Close destination file
+	return status;
+}
+
+// Stop writing to destination i of a fan-out copy after an error
+static void fanout_drop(int *fds, int i, const char *dst, copy_result_t *result) {
+	perror(dst);
+	if (fds[i] != -1) close(fds[i]);
+	fds[i] = -1;
+	result->failed_dests |= 1ULL << i;
+}
+
+// Fan-out copy: read [offset, offset + length) of src once through the worker's whole buffer
+// (at least COPY_DIRECT_MIN) and write each buffer to all count destinations in turn before
+// reading the next. The writes only fill the page cache; the destinations are written back
+// in parallel by the kernel, so a slow or synchronous destination holds up the others.
+// A length of 0 means the whole file: the destinations are created and truncated here.
+// Chunks write into destinations the walker already sized. Holes are skipped on every side
+// as in copy_data_extents. A destination that fails is reported and dropped while the
+// others carry on. Returns 0 if every destination got the range, -1 otherwise;
+// result->failed_dests tells which did not.
+int copy_fanout(const char *src, char *const *dsts, int count, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result) {
+	result->bytes = 0;
+	result->skipped = 0;
+	result->holes = 0;
+	result->deduped = 0;
+	result->method = COPY_METHOD_READ_WRITE;
+	result->failed_dests = 0;
+	int src_fd = open(src, O_RDONLY);    // Open source file for reading
+	struct stat st;
+	if (src_fd == -1 || fstat(src_fd, &st) == -1) {
+		perror("open src");
+		if (src_fd != -1) close(src_fd);
+		result->failed_dests = (1ULL << count) - 1;
+		return -1;
+	}
+	int whole = length == 0;
+	if (whole) {
+		offset = 0;
+		length = st.st_size;
+	}
+	int sparse = copy_is_sparse(&st);
+	int fds[count];
+	int live = 0;
+	for (int i = 0; i < count; i++) {
+		fds[i] = open(dsts[i], whole ? O_WRONLY | O_CREAT | O_TRUNC : O_WRONLY, 0644);
+		if (fds[i] == -1 || (whole && sparse && ftruncate(fds[i], st.st_size) == -1)) {
+			fanout_drop(fds, i, dsts[i], result);
+			continue;
+		}
+		if (whole && !sparse && st.st_size >= COPY_PREALLOC_MIN) {
+			fallocate(fds[i], FALLOC_FL_KEEP_SIZE, 0, st.st_size);  // Best effort, as in copy_file
+		}
+		live++;
+	}
+
+	int status = 0;
+	off_t pos = offset;
+	off_t end = offset + length;
+	size_t chunk = ctx->buf_size;   // Every destination write costs a syscall, so read as much as fits
+	while (pos < end && live > 0 && status == 0) {
+		off_t hole = end;
+		if (sparse) {
+			off_t data = lseek(src_fd, pos, SEEK_DATA);
+			if (data == -1 && errno == ENXIO) data = end;   // Only a hole is left
+			if (data == -1 || (data < end && (hole = lseek(src_fd, data, SEEK_HOLE)) == -1)) {
+				status = -1;
+				break;
+			}
+			if (data > end) data = end;
+			if (hole > end) hole = end;
+			result->holes += data - pos;
+			if (ctx->hash != NULL) {
+				checksum_stream_zeros(ctx->hash, data - pos);
+			}
+			pos = data;
+		}
+		while (pos < hole && live > 0) {
+			size_t want = hole - pos < (off_t)chunk ? (size_t)(hole - pos) : chunk;
+			ssize_t bytes_read = pread(src_fd, ctx->buf, want, pos);  // Read from the source file once
+			if (bytes_read == -1 && errno == EINTR) continue;
+			if (bytes_read == -1) {
+				status = -1;
+				break;
+			}
+			if (bytes_read == 0) {      // The source shrank
+				end = pos;
+				break;
+			}
+			if (ctx->hash != NULL) {
+				checksum_stream_update(ctx->hash, ctx->buf, (size_t)bytes_read);
+			}
+			for (int i = 0; i < count; i++) {   // Then write it to every destination still in the copy
+				if (fds[i] == -1) continue;
+				for (ssize_t done = 0; done < bytes_read; ) {
+					ssize_t written = pwrite(fds[i], ctx->buf + done, (size_t)(bytes_read - done), pos + done);
+					if (written == -1 && errno == EINTR) continue;
+					if (written == -1) {
+						fanout_drop(fds, i, dsts[i], result);
+						live--;
+						break;
+					}
+					done += written;
+				}
+			}
+			pos += bytes_read;
+			result->bytes += bytes_read;
+		}
+	}
+	if (status == -1) {
+		perror(src);
+	}
+	for (int i = 0; i < count; i++) {
+		if (fds[i] == -1) continue;
+		if (status == -1) result->failed_dests |= 1ULL << i;    // Source read failed, nobody got the file
+		close(fds[i]);
+	}
+	close(src_fd);
+	return result->failed_dests == 0 ? 0 : -1;
+}
+
+// Compare [offset, offset + length) of both files: 1 if identical, 0 if not, -1 on read error
+int copy_range_identical(int src_fd, int dst_fd, off_t offset, off_t length, int buffer_size) {
+	size_t block = buffer_size > COMPARE_BLOCK ? (size_t)buffer_size : COMPARE_BLOCK;
+	char *src_buf = (char *)malloc(block);
+	char *dst_buf = (char *)malloc(block);
+	int identical = -1;
+	if (src_buf == NULL || dst_buf == NULL) {
+		goto out;
+	}
+	identical = 1;
+	for (off_t done = 0; done < length && identical == 1; ) {
+		size_t want = length - done < (off_t)block ? (size_t)(length - done) : block;
+		ssize_t src_read = pread(src_fd, src_buf, want, offset + done);
+		ssize_t dst_read = pread(dst_fd, dst_buf, want, offset + done);
+		if (src_read == -1 || dst_read == -1) {
+			identical = -1;
+		} else if (src_read != dst_read || src_read == 0 || memcmp(src_buf, dst_buf, (size_t)src_read) != 0) {
+			identical = 0;
+		} else {
+			done += src_read;
+		}
+	}
+out:
+	free(src_buf);
+	free(dst_buf);
+	return identical;
+}
+
+// Sync mode: copy [offset, offset + length) only if it differs from what the destination
+// already holds. A length of 0 means the whole file, which is also truncated to the source size.
+int copy_file_if_changed(const char *src, const char *dst, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result) {
+	result->bytes = 0;
+	result->skipped = 0;
+	result->holes = 0;
+	result->deduped = 0;
+	result->method = COPY_METHOD_READ_WRITE;
+	int src_fd = open(src, O_RDONLY);    // Open source file for reading
+	if (src_fd == -1) {
+		perror("open src");
+		return -1;
+	}
+	int dst_fd = open(dst, O_RDWR | O_CREAT, 0644);     // Keep the existing contents to compare against
+	if (dst_fd == -1) {
+		perror("open dst");
+		close(src_fd);
+		return -1;
+	}
+	struct stat src_stat, dst_stat;
+	if (fstat(src_fd, &src_stat) == -1 || fstat(dst_fd, &dst_stat) == -1) {
+		perror("fstat");
+		close(src_fd);
+		close(dst_fd);
+		return -1;
+	}
+
+	int whole = length == 0;
+	if (whole) {
+		offset = 0;
+		length = src_stat.st_size;
+	}
+	int status = 0;
+	int identical = dst_stat.st_size == src_stat.st_size ? copy_range_identical(src_fd, dst_fd, offset, length, ctx->buffer_size) : 0;
+	if (identical == 1) {
+		result->skipped = length;
+		if (ctx->engine == ENGINE_AUTO || ctx->engine == ENGINE_COPY_FILE_RANGE) {
+			result->method = COPY_METHOD_COPY_FILE_RANGE;   // Path copy_range() would have taken
+		}
+	} else {
+		status = copy_range(src_fd, dst_fd, offset, length, ctx, result);
+		if (status == 0 && whole && ftruncate(dst_fd, src_stat.st_size) == -1) {     // Drop a longer old tail
+			status = -1;
+		}
+		if (status == -1) {
+			perror("copy");
+		}
+	}
+	close(src_fd);    // Close source file
+	close(dst_fd);    // Close destination file
+	return status;
+}
+
+// Delta mode: compare every block of [offset, offset + length) in both files and rewrite
+// only the blocks that differ. A length of 0 means the whole file, which is first resized
+// to the source size; chunks of a split file rely on the walker having done that already.
+int copy_file_delta(const char *src, const char *dst, off_t offset, off_t length, size_t block, copy_result_t *result) {
+	result->bytes = 0;
+	result->skipped = 0;
+	result->holes = 0;
+	result->deduped = 0;
+	result->method = COPY_METHOD_READ_WRITE;
+	int src_fd = open(src, O_RDONLY);    // Open source file for reading
+	if (src_fd == -1) {
+		perror("open src");
+		return -1;
+	}
+	int dst_fd = open(dst, O_RDWR | O_CREAT, 0644);     // Keep the existing blocks
+	if (dst_fd == -1) {
+		perror("open dst");
+		close(src_fd);
+		return -1;
+	}
+	char *src_buf = (char *)malloc(block);
+	char *dst_buf = (char *)malloc(block);
+	int status = -1;
+	struct stat src_stat, dst_stat;
+	if (src_buf == NULL || dst_buf == NULL) {
+		perror("malloc");
+		goto out;
+	}
+	if (fstat(src_fd, &src_stat) == -1 || fstat(dst_fd, &dst_stat) == -1) {
+		perror("fstat");
+		goto out;
+	}
+	if (length == 0) {
+		offset = 0;
+		length = src_stat.st_size;
+		if (dst_stat.st_size != src_stat.st_size && ftruncate(dst_fd, src_stat.st_size) == -1) {
+			perror("ftruncate");
+			goto out;
+		}
+	}
+
+	status = 0;
+	for (off_t done = 0; done < length; ) {
+		size_t want = length - done < (off_t)block ? (size_t)(length - done) : block;
+		ssize_t src_read = pread(src_fd, src_buf, want, offset + done);
+		ssize_t dst_read = pread(dst_fd, dst_buf, want, offset + done);
+		if (src_read <= 0 || dst_read == -1) {  // Source shrank under us or I/O error
+			status = -1;
+			break;
+		}
+		if (dst_read == src_read && memcmp(src_buf, dst_buf, (size_t)src_read) == 0) {
+			result->skipped += src_read;    // Block already matches
+		} else {
+			for (ssize_t written = 0; written < src_read; ) {
+				ssize_t n = pwrite(dst_fd, src_buf + written, (size_t)(src_read - written), offset + done + written);
+				if (n == -1) {
+					if (errno == EINTR) continue;
+					status = -1;
+					break;
+				}
+				written += n;
+			}
+			if (status == -1) break;
+			result->bytes += src_read;
+		}
+		done += src_read;
+	}
+	if (status == -1) {
+		perror("delta");
+	}
+out:
+	free(src_buf);
+	free(dst_buf);
+	close(src_fd);    // Close source file
+	close(dst_fd);    // Close destination file
+	return status;
+}
@@ -0,0 +1,78 @@
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "checksum.h"
+
+// Copy backend requested on the command line
+typedef enum {
+	ENGINE_AUTO,                // Try a reflink, then the kernel-side paths, fall back to read/write
+	ENGINE_COPY_FILE_RANGE,     // Start with copy_file_range()
+	ENGINE_SENDFILE,            // Start with sendfile()
+	ENGINE_SPLICE,              // Start with splice() through a pipe
+	ENGINE_READ_WRITE           // Plain read()/write() loop through a user-space buffer
+} copy_engine_t;
+
+// Path a file actually took, one per backend
+typedef enum {
+	COPY_METHOD_COPY_FILE_RANGE,
+	COPY_METHOD_SENDFILE,
+	COPY_METHOD_SPLICE,
+	COPY_METHOD_READ_WRITE,
+	COPY_METHOD_IO_URING,       // Asynchronous reads/writes from the io_uring workers
+	COPY_METHOD_DIRECT,         // O_DIRECT reads/writes bypassing the page cache
+	COPY_METHOD_CLONE,          // FICLONE/FICLONERANGE reflink sharing the source extents
+	COPY_METHOD_LINK,           // Hardlink to an identical file already copied (dedup)
+	COPY_METHOD_TAR,            // Read into the tar archive stream
+	COPY_METHOD_COUNT
+} copy_method_t;
+
+// Outcome of a single file copy
+typedef struct {
+	copy_method_t method;       // Last backend that moved bytes (the one that finished the file)
+	long long bytes;            // Bytes written to the destination
+	long long skipped;          // Bytes found identical in the destination and left alone
+	long long holes;            // Bytes of source holes left unwritten
+	long long deduped;          // Bytes not written because an identical copy was linked or cloned
+	uint64_t digest;            // Verify mode: digest of the source bytes, set by the worker
+	unsigned long long failed_dests;    // Fan-out: bit i set for every destination i that failed
+} copy_result_t;
+
+#define COPY_IO_ALIGN 4096          // Buffer, offset and length alignment for O_DIRECT
+#define COPY_DIRECT_MIN (1 << 20)   // Smallest O_DIRECT transfer, small direct I/O is slow
+#define COPY_PREALLOC_MIN (1 << 20) // Files at least this large get their extents reserved up front
+#define COPY_CLONE_CACHE 8          // Source devices per worker remembered as unable to reflink
+#define COPY_DEFER 1                // copy_file: the worker links or splits this source itself
+
+// Per-worker copy settings and the worker's I/O buffer, allocated once for all its files
+typedef struct {
+	copy_engine_t engine;       // Backend selected on the command line
+	int buffer_size;            // Bytes per read()/write() in buffered mode
+	int direct;                 // Copy with O_DIRECT where the filesystem allows it
+	int drop_cache;             // Buffered mode: flush and drop the copied pages afterwards
+	char *buf;                  // COPY_IO_ALIGN aligned buffer
+	size_t buf_size;            // Bytes in buf, also the O_DIRECT transfer size
+	checksum_stream_t *hash;    // Verify mode: every byte read into buf is hashed here, NULL otherwise
+	int defer_links;            // Unstat'ed tasks: hand sources with several links back (COPY_DEFER)
+	long long defer_above;      // Unstat'ed tasks: hand larger sources back for splitting, 0 never
+	dev_t no_clone[COPY_CLONE_CACHE];   // Auto engine: source devices whose files cannot be reflinked
+	int no_clone_count;         // Entries in no_clone
+} copy_ctx_t;
+
+int parse_copy_engine(const char *name, copy_engine_t *engine);
+const char *copy_method_name(copy_method_t method);
+size_t copy_buffer_size(int buffer_size, int large);
+int copy_is_sparse(const struct stat *st);
+int copy_clone(int src_fd, int dst_fd, off_t offset, off_t length);
+int copy_range_identical(int src_fd, int dst_fd, off_t offset, off_t length, int buffer_size);
+int copy_fd(int src_fd, int dst_fd, copy_ctx_t *ctx, copy_result_t *result);
+int copy_file(const char *src, const char *dst, copy_ctx_t *ctx, copy_result_t *result);
+int copy_range(int src_fd, int dst_fd, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result);
+int copy_file_if_changed(const char *src, const char *dst, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result);
+int copy_file_delta(const char *src, const char *dst, off_t offset, off_t length, size_t block, copy_result_t *result);
+int copy_data_extents(int src_fd, int dst_fd, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result);
+int copy_file_part(const char *src, const char *dst, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result);
+int copy_fanout(const char *src, char *const *dsts, int count, off_t offset, off_t length, copy_ctx_t *ctx, copy_result_t *result);
+
+#endif //COPY_ENGINE_H
@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include "dedup.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// Map a command line dedup mode to its enum value
+int parse_dedup_mode(const char *name, dedup_mode_t *mode) {
+	if (strcmp(name, "clone") == 0) {
+		*mode = DEDUP_CLONE;
+	} else if (strcmp(name, "link") == 0) {
+		*mode = DEDUP_LINK;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+dedup_t *dedup_create(dedup_mode_t mode) {
+	dedup_t *dedup = (dedup_t *)calloc(1, sizeof(dedup_t));
+	if (dedup == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	dedup->mode = mode;
+	atomic_init(&dedup->disabled, 0);
+	atomic_init(&dedup->hashed_bytes, 0);
+	for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+		pthread_mutex_init(&dedup->locks[i], NULL);
+	}
+	return dedup;
+}
+
+void dedup_destroy(dedup_t *dedup) {
+	for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+		dedup_entry_t *entry = dedup->buckets[i];
+		while (entry != NULL) {
+			dedup_entry_t *next = entry->next;
+			free(entry->src);
+			free(entry->dst);
+			free(entry);
+			entry = next;
+		}
+		pthread_mutex_destroy(&dedup->locks[i]);
+	}
+	free(dedup);
+}
+
+// Sizes are often multiples of a block, mix them before taking the bucket
+static size_t bucket_of(off_t size) {
+	uint64_t h = (uint64_t)size * 0x9E3779B97F4A7C15ULL;
+	return (size_t)((h ^ (h >> 32)) % HASH_TABLE_SIZE);
+}
+
+// Hash a whole file through the worker's buffer, each block's hash seeding the next
+static int hash_file(dedup_t *dedup, const char *path, copy_ctx_t *ctx, uint64_t *hash) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return -1;
+	uint64_t h = 0;
+	for (;;) {
+		ssize_t n = read(fd, ctx->buf, ctx->buf_size);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) {
+			close(fd);
+			return -1;
+		}
+		if (n == 0) break;
+		h = checksum64(ctx->buf, (size_t)n, h);
+		atomic_fetch_add_explicit(&dedup->hashed_bytes, n, memory_order_relaxed);
+	}
+	close(fd);
+	*hash = h;
+	return 0;
+}
+
+// Make dst a hardlink or reflink of the finished copy of an identical file. The contents are
+// compared byte for byte first, equal hashes are not proof. Returns 1 if dst now exists,
+// 0 if the caller has to copy the file after all.
+static int link_duplicate(dedup_t *dedup, const dedup_entry_t *first, const char *src, const char *dst,
+		off_t size, copy_ctx_t *ctx, copy_result_t *result) {
+	int src_fd = open(src, O_RDONLY | O_CLOEXEC);
+	int first_fd = open(first->dst, O_RDONLY | O_CLOEXEC);
+	int linked = 0;
+	if (src_fd != -1 && first_fd != -1 && copy_range_identical(src_fd, first_fd, 0, size, ctx->buffer_size) == 1) {
+		struct stat dst_stat;
+		if (dedup->mode == DEDUP_LINK && lstat(dst, &dst_stat) == 0 && dst_stat.st_nlink > 1) {
+			linked = 0;     // Replacing dst would cut it off from its own hardlinks
+		} else if (dedup->mode == DEDUP_LINK) {
+			linked = (unlink(dst) == 0 || errno == ENOENT) && link(first->dst, dst) == 0;
+		} else {
+			int dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (dst_fd != -1) {
+				linked = copy_clone(first_fd, dst_fd, 0, 0) == 0;
+				if (!linked && (errno == EOPNOTSUPP || errno == EXDEV || errno == EINVAL || errno == ENOTTY) &&
+						atomic_exchange(&dedup->disabled, 1) == 0) {    // Stop hashing for nothing
+					fprintf(stderr, "Destination does not support reflinks, dedup disabled (try --dedup=link)\n");
+				}
+				close(dst_fd);
+			}
+		}
+	}
+	if (src_fd != -1) close(src_fd);
+	if (first_fd != -1) close(first_fd);
+	if (!linked) return 0;
+	result->bytes = 0;
+	result->skipped = 0;
+	result->holes = 0;
+	result->deduped = size;
+	result->method = dedup->mode == DEDUP_LINK ? COPY_METHOD_LINK : COPY_METHOD_CLONE;
+	return 1;
+}
+
+// Look src up by size and content. Returns 1 when dst was created as a link or clone of an
+// identical file that is already copied; result describes it. Returns 0 when the caller has to
+// copy the file itself; if *entry is set, the caller reports the outcome with dedup_finish()
+// so later duplicates can use this copy. Files are hashed with the bucket lock dropped, which
+// only covers the lookup and the insert; the bucket is scanned again after every hash since
+// other threads may have added or hashed entries meanwhile.
+int dedup_find(dedup_t *dedup, const char *src, const char *dst, off_t size, copy_ctx_t *ctx,
+		dedup_entry_t **entry, copy_result_t *result) {
+	*entry = NULL;
+	if (size < DEDUP_MIN_SIZE || atomic_load(&dedup->disabled)) return 0;
+	size_t bucket = bucket_of(size);
+	dedup_entry_t *match = NULL;
+	int pending = 0;        // An identical file is still being copied, do not add a second entry
+	int hashed = 0;
+	uint64_t hash = 0;
+	pthread_mutex_lock(&dedup->locks[bucket]);
+	for (;;) {
+		dedup_entry_t *unhashed = NULL;     // A file of this size whose hash is still deferred
+		int same_size = 0;
+		pending = 0;
+		for (dedup_entry_t *e = dedup->buckets[bucket]; e != NULL; e = e->next) {
+			if (e->size != size) continue;
+			same_size = 1;
+			if (e->hashed == 0) {
+				unhashed = e;
+			} else if (hashed && e->hashed == 1 && e->hash == hash) {
+				if (atomic_load(&e->ready)) {
+					match = e;
+					break;
+				}
+				pending = 1;
+			}
+		}
+		if (match != NULL || !same_size || (hashed && unhashed == NULL)) break;
+		pthread_mutex_unlock(&dedup->locks[bucket]);
+		if (!hashed) {
+			if (hash_file(dedup, src, ctx, &hash) == -1) return 0;
+			hashed = 1;
+		} else {    // Deferred until a second file of this size showed up
+			uint64_t other;
+			int status = hash_file(dedup, unhashed->src, ctx, &other);
+			pthread_mutex_lock(&dedup->locks[bucket]);
+			if (unhashed->hashed == 0) {    // Another thread may have hashed it meanwhile
+				unhashed->hash = other;
+				unhashed->hashed = status == 0 ? 1 : -1;
+			}
+			pthread_mutex_unlock(&dedup->locks[bucket]);
+		}
+		pthread_mutex_lock(&dedup->locks[bucket]);
+	}
+	if (match == NULL && !pending) {
+		dedup_entry_t *added = (dedup_entry_t *)calloc(1, sizeof(dedup_entry_t));
+		if (added != NULL && (added->src = strdup(src)) != NULL && (added->dst = strdup(dst)) != NULL) {
+			added->size = size;
+			added->hash = hash;
+			added->hashed = hashed;
+			atomic_init(&added->ready, 0);
+			added->next = dedup->buckets[bucket];
+			dedup->buckets[bucket] = added;
+			*entry = added;
+		} else if (added != NULL) {
+			free(added->src);
+			free(added);
+		}
+	}
+	pthread_mutex_unlock(&dedup->locks[bucket]);
+	return match != NULL ? link_duplicate(dedup, match, src, dst, size, ctx, result) : 0;
+}
+
+// The caller finished copying the file it got entry for; a successful copy becomes linkable
+void dedup_finish(dedup_entry_t *entry, int status) {
+	if (entry != NULL && status == 0) {
+		atomic_store(&entry->ready, 1);
+	}
+}
+
+// copy_file() that links or clones duplicates of already copied files instead
+int dedup_copy_file(dedup_t *dedup, const char *src, const char *dst, copy_ctx_t *ctx, copy_result_t *result) {
+	struct stat st;
+	dedup_entry_t *entry = NULL;
+	if (stat(src, &st) == 0 && dedup_find(dedup, src, dst, st.st_size, ctx, &entry, result) == 1) {
+		return 0;
+	}
+	int status = copy_file(src, dst, ctx, result);
+	dedup_finish(entry, status);
+	return status;
+}
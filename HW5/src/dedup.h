@@ -0,0 +1,48 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "copy_engine.h"
+#include "task.h"
+
+#define DEDUP_MIN_SIZE 4096     // Smaller files are cheaper to copy than to hash and compare
+
+// How a duplicate reaches the destination
+typedef enum {
+	DEDUP_CLONE,                // FICLONE reflink of the first copy, independent files sharing extents
+	DEDUP_LINK                  // Hardlink to the first copy, one inode
+} dedup_mode_t;
+
+// A source file whose copy others may link to. Entries are never removed before
+// dedup_destroy(), so a pointer stays valid after the bucket lock is dropped.
+typedef struct dedup_entry {
+	struct dedup_entry *next;   // Next entry in the bucket
+	off_t size;                 // File size, the bucket key
+	uint64_t hash;              // Content hash, valid once hashed is 1
+	int hashed;                 // 1 hashed, -1 unreadable, 0 deferred until a second file of this size shows up
+	atomic_int ready;           // Destination fully copied, duplicates may use it
+	char *src;                  // Source path, read to compute the hash
+	char *dst;                  // Destination path duplicates link or clone
+} dedup_entry_t;
+
+// Content hash table keyed by size, then by XXH64 of the contents. Files are only hashed
+// when another file of the same size exists, so unique sizes cost a lookup and nothing else.
+typedef struct dedup {
+	dedup_mode_t mode;          // Hardlinks or reflinks
+	atomic_int disabled;        // Reflinks turned out to be unsupported on the destination
+	atomic_llong hashed_bytes;  // Bytes read to compute hashes
+	dedup_entry_t *buckets[HASH_TABLE_SIZE];    // Chains of entries
+	pthread_mutex_t locks[HASH_TABLE_SIZE];     // One lock per bucket
+} dedup_t;
+
+int parse_dedup_mode(const char *name, dedup_mode_t *mode);
+dedup_t *dedup_create(dedup_mode_t mode);
+void dedup_destroy(dedup_t *dedup);
+int dedup_find(dedup_t *dedup, const char *src, const char *dst, off_t size, copy_ctx_t *ctx,
+		dedup_entry_t **entry, copy_result_t *result);
+void dedup_finish(dedup_entry_t *entry, int status);
+int dedup_copy_file(dedup_t *dedup, const char *src, const char *dst, copy_ctx_t *ctx, copy_result_t *result);
+
+#endif //DEDUP_H
@@ -0,0 +1,173 @@
+#include "devices.h"
+#include "copier.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void devices_init(devices_t *devices, buffer_t *buffer, struct sched *sched, int batch_size, int limit) {
+	memset(devices, 0, sizeof(*devices));
+	devices->buffer = buffer;
+	devices->sched = sched;
+	devices->batch_size = batch_size;
+	devices->limit = limit > 0 ? limit : 1;
+	pthread_mutex_init(&devices->mutex, NULL);
+	pthread_cond_init(&devices->cond, NULL);
+}
+
+void devices_destroy(devices_t *devices) {
+	for (int i = 0; i < devices->num_queues; i++) {
+		free(devices->queues[i].tasks);
+		free(devices->queues[i].sizes);
+	}
+	free(devices->queues);
+	pthread_mutex_destroy(&devices->mutex);
+	pthread_cond_destroy(&devices->cond);
+}
+
+// Index of the queue for a device pair, added on first sight; called once per directory
+int devices_lookup(devices_t *devices, dev_t src_dev, dev_t dst_dev) {
+	pthread_mutex_lock(&devices->mutex);
+	int i = 0;
+	while (i < devices->num_queues && (devices->queues[i].src_dev != src_dev || devices->queues[i].dst_dev != dst_dev)) {
+		i++;
+	}
+	if (i == devices->num_queues) {
+		if (devices->num_queues == devices->capacity) {
+			int capacity = devices->capacity ? devices->capacity * 2 : 4;
+			device_queue_t *queues = (device_queue_t *)realloc(devices->queues, sizeof(device_queue_t) * (size_t)capacity);
+			if (queues == NULL) {
+				perror("malloc");
+				exit(EXIT_FAILURE);
+			}
+			devices->queues = queues;
+			devices->capacity = capacity;
+		}
+		devices->queues[i] = (device_queue_t){.src_dev = src_dev, .dst_dev = dst_dev};
+		devices->num_queues++;
+	}
+	pthread_mutex_unlock(&devices->mutex);
+	return i;
+}
+
+// Append a task to its queue, growing the ring like the walkers' deques
+static void queue_push(device_queue_t *queue, const file_info_t *task, long long size) {
+	if (queue->count == queue->capacity) {
+		size_t capacity = queue->capacity ? queue->capacity * 2 : 256;
+		file_info_t *tasks = (file_info_t *)malloc(sizeof(file_info_t) * capacity);
+		long long *sizes = (long long *)malloc(sizeof(long long) * capacity);
+		if (tasks == NULL || sizes == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < queue->count; i++) {
+			tasks[i] = queue->tasks[(queue->head + i) % queue->capacity];
+			sizes[i] = queue->sizes[(queue->head + i) % queue->capacity];
+		}
+		free(queue->tasks);
+		free(queue->sizes);
+		queue->tasks = tasks;
+		queue->sizes = sizes;
+		queue->capacity = capacity;
+		queue->head = 0;
+	}
+	queue->tasks[(queue->head + queue->count) % queue->capacity] = *task;
+	queue->sizes[(queue->head + queue->count) % queue->capacity] = size;
+	queue->count++;
+}
+
+// Queue walker tasks by device; the caller already holds a directory reference for each
+void devices_add_batch(devices_t *devices, const file_info_t *tasks, const long long *sizes, int count) {
+	pthread_mutex_lock(&devices->mutex);
+	for (int i = 0; i < count; i++) {
+		queue_push(&devices->queues[tasks[i].dir->device], &tasks[i], sizes[i]);
+	}
+	devices->pending += (size_t)count;
+	pthread_cond_signal(&devices->cond);
+	pthread_mutex_unlock(&devices->mutex);
+}
+
+// A dispatched task of the queue finished (or was dropped); its slot goes to the next waiting task
+void devices_release(devices_t *devices, int queue, long long bytes) {
+	pthread_mutex_lock(&devices->mutex);
+	devices->queues[queue].inflight--;
+	devices->queues[queue].bytes += bytes;
+	pthread_cond_signal(&devices->cond);
+	pthread_mutex_unlock(&devices->mutex);
+}
+
+// Take up to batch_size tasks from the first queue, starting at next, that has work and room
+// in flight; returns the number taken, 0 when every queue with work is at its limit. After
+// SIGINT the limit no longer applies since the tasks are only dropped.
+static int take_batch(devices_t *devices, file_info_t *batch, long long *sizes) {
+	for (int n = 0; n < devices->num_queues; n++) {
+		int i = (devices->next + n) % devices->num_queues;
+		device_queue_t *queue = &devices->queues[i];
+		if (queue->count == 0) continue;
+		int room = termination_flag ? devices->batch_size : devices->limit - queue->inflight;
+		if (room <= 0) {
+			queue->throttled++;
+			continue;
+		}
+		int count = 0;
+		while (queue->count > 0 && count < room && count < devices->batch_size) {
+			sizes[count] = queue->sizes[queue->head];
+			batch[count++] = queue->tasks[queue->head];
+			queue->head = (queue->head + 1) % queue->capacity;
+			queue->count--;
+		}
+		queue->inflight += count;
+		if (queue->inflight > queue->peak) queue->peak = queue->inflight;
+		queue->dispatched += count;
+		devices->pending -= (size_t)count;
+		devices->next = (i + 1) % devices->num_queues;    // Round-robin between devices
+		return count;
+	}
+	return 0;
+}
+
+// Dispatcher thread: moves tasks from queues below their in-flight limit to the scheduler or
+// the buffer, and sleeps while every queue with work is at its limit
+static void *dispatcher_thread(void *arg) {
+	devices_t *devices = (devices_t *)arg;
+	file_info_t batch[TASK_BATCH_MAX];
+	long long sizes[TASK_BATCH_MAX];
+	pthread_mutex_lock(&devices->mutex);
+	for (;;) {
+		int count = devices->pending > 0 ? take_batch(devices, batch, sizes) : 0;
+		if (count == 0) {
+			if (devices->pending == 0 && devices->closed) break;    // Walk over and everything dispatched
+			pthread_cond_wait(&devices->cond, &devices->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&devices->mutex);
+		if (termination_flag) {
+			for (int i = 0; i < count; i++) {
+				drop_task(&batch[i]);
+			}
+		} else if (devices->sched != NULL) {
+			sched_add_batch(devices->sched, batch, sizes, count);
+		} else {
+			buffer_add_batch(devices->buffer, batch, count);
+		}
+		pthread_mutex_lock(&devices->mutex);
+	}
+	pthread_mutex_unlock(&devices->mutex);
+	return NULL;
+}
+
+int devices_start(devices_t *devices) {
+	if (pthread_create(&devices->thread, NULL, dispatcher_thread, devices) != 0) {
+		perror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+// No more tasks will be added: wait until the dispatcher has handed all of them on
+void devices_finish(devices_t *devices) {
+	pthread_mutex_lock(&devices->mutex);
+	devices->closed = 1;
+	pthread_cond_signal(&devices->cond);
+	pthread_mutex_unlock(&devices->mutex);
+	pthread_join(devices->thread, NULL);
+}
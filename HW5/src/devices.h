@@ -0,0 +1,56 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "buffer.h"
+
+struct sched;
+
+// Tasks of one source and destination device pair
+typedef struct {
+	dev_t src_dev;              // Device the files are read from
+	dev_t dst_dev;              // Device they are written to
+	file_info_t *tasks;         // Ring of waiting tasks in queuing order
+	long long *sizes;           // Size of each task, for the scheduler
+	size_t head;                // Oldest waiting task
+	size_t count;               // Waiting tasks
+	size_t capacity;            // Allocated tasks
+	int inflight;               // Dispatched and not finished yet
+	int peak;                   // Most tasks ever in flight at once
+	long long dispatched;       // Tasks handed on
+	long long bytes;            // Bytes copied by the finished tasks
+	long long throttled;        // Dispatch passes that found it at its limit with work waiting
+} device_queue_t;
+
+// Per-device admission in front of the buffer. Each directory is assigned the queue of its
+// source and destination st_dev pair; walkers queue there instead of in the shared buffer,
+// and a dispatcher thread moves tasks on round-robin, but only from queues with fewer than
+// limit tasks in flight. A slow disk can then occupy at most limit buffer cells and workers,
+// and the rest keep feeding the other devices. A task stays in flight from dispatch until a
+// worker records it (or drops it after SIGINT) and calls devices_release().
+typedef struct devices {
+	buffer_t *buffer;           // Buffer feeding the workers
+	struct sched *sched;        // Largest-first stage between here and the buffer, NULL for none
+	int batch_size;             // Most tasks moved from one queue per pass
+	int limit;                  // In-flight tasks allowed per device pair
+	device_queue_t *queues;     // Known device pairs
+	int num_queues;             // Queues in use
+	int capacity;               // Allocated queues
+	size_t pending;             // Waiting tasks in all queues
+	int next;                   // Queue the next dispatch pass starts at
+	int closed;                 // The walk is over, no more tasks will arrive
+	pthread_mutex_t mutex;      // Protects everything above
+	pthread_cond_t cond;        // Signaled when tasks arrive, finish, or the walk ends
+	pthread_t thread;           // Dispatcher
+} devices_t;
+
+void devices_init(devices_t *devices, buffer_t *buffer, struct sched *sched, int batch_size, int limit);
+void devices_destroy(devices_t *devices);
+int devices_start(devices_t *devices);
+int devices_lookup(devices_t *devices, dev_t src_dev, dev_t dst_dev);
+void devices_add_batch(devices_t *devices, const file_info_t *tasks, const long long *sizes, int count);
+void devices_release(devices_t *devices, int queue, long long bytes);
+void devices_finish(devices_t *devices);
+
+#endif //DEVICES_H
@@ -0,0 +1,55 @@
+#include "fanout.h"
+#include <string.h>
+
+void fanout_init(fanout_t *fanout, char *const *roots, int count) {
+	memset(fanout, 0, sizeof(*fanout));
+	fanout->count = count;
+	fanout->root_len = strlen(roots[0]);
+	for (int i = 0; i < count; i++) {
+		fanout->dests[i].root = roots[i];
+		atomic_init(&fanout->dests[i].files, 0);
+		atomic_init(&fanout->dests[i].bytes, 0);
+		atomic_init(&fanout->dests[i].failed, 0);
+	}
+}
+
+// Path in destination dest of dst, a path below the first destination
+void fanout_path(const fanout_t *fanout, int dest, const char *dst, char *out, size_t size) {
+	snprintf(out, size, "%s%s", fanout->dests[dest].root, dst + fanout->root_len);
+}
+
+// An entry other than a copied file could not be created in dest
+void fanout_fail(fanout_t *fanout, int dest) {
+	atomic_fetch_add_explicit(&fanout->dests[dest].failed, 1, memory_order_relaxed);
+}
+
+// A file is finished; bit i of failed is set for every destination i that did not get it
+void fanout_record(fanout_t *fanout, unsigned long long failed, long long bytes) {
+	for (int i = 0; i < fanout->count; i++) {
+		if (failed & (1ULL << i)) {
+			atomic_fetch_add_explicit(&fanout->dests[i].failed, 1, memory_order_relaxed);
+		} else {
+			atomic_fetch_add_explicit(&fanout->dests[i].files, 1, memory_order_relaxed);
+			atomic_fetch_add_explicit(&fanout->dests[i].bytes, bytes, memory_order_relaxed);
+		}
+	}
+}
+
+void fanout_print(const fanout_t *fanout) {
+	printf("Destinations: %d, every file read once\n", fanout->count);
+	for (int i = 0; i < fanout->count; i++) {
+		const fanout_dest_t *dest = &fanout->dests[i];
+		printf("  %s: %lld files, %lld bytes, %lld failed\n", dest->root, (long long)atomic_load(&dest->files),
+				(long long)atomic_load(&dest->bytes), (long long)atomic_load(&dest->failed));
+	}
+}
+
+void fanout_write_json(const fanout_t *fanout, FILE *out) {
+	fprintf(out, "  \"destinations\": [");
+	for (int i = 0; i < fanout->count; i++) {
+		const fanout_dest_t *dest = &fanout->dests[i];
+		fprintf(out, "%s\n    {\"root\": \"%s\", \"files\": %lld, \"bytes\": %lld, \"failed\": %lld}", i ? "," : "", dest->root,
+				(long long)atomic_load(&dest->files), (long long)atomic_load(&dest->bytes), (long long)atomic_load(&dest->failed));
+	}
+	fprintf(out, "\n  ],\n");
+}
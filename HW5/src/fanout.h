@@ -0,0 +1,37 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define FANOUT_MAX 16               // Destinations one run can write
+
+// One destination tree and what landed in it
+typedef struct {
+	const char *root;           // Destination directory
+	atomic_llong files;         // Files fully written here
+	atomic_llong bytes;         // Their bytes
+	atomic_llong failed;        // Files, directories, links and FIFOs that could not be created here
+} fanout_dest_t;
+
+// Several destinations fed from one read of the source. The walkers and dir_ref_t keep
+// working on the first destination; every other one mirrors it under its own root, so a
+// destination path is the first destination's path with the root swapped. Walkers repeat
+// each directory, FIFO, symlink and hardlink in the other trees, and the workers write
+// every buffer they read to all destinations (copy_fanout). A destination that fails is
+// only dropped for that file; the others carry on.
+typedef struct fanout {
+	fanout_dest_t dests[FANOUT_MAX];    // dests[0] is params->dst_dir
+	int count;                  // Destinations in use
+	size_t root_len;            // Length of dests[0].root, the prefix swapped out
+} fanout_t;
+
+void fanout_init(fanout_t *fanout, char *const *roots, int count);
+void fanout_path(const fanout_t *fanout, int dest, const char *dst, char *out, size_t size);
+void fanout_fail(fanout_t *fanout, int dest);
+void fanout_record(fanout_t *fanout, unsigned long long failed, long long bytes);
+void fanout_print(const fanout_t *fanout);
+void fanout_write_json(const fanout_t *fanout, FILE *out);
+
+#endif //FANOUT_H
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define GEN_FILES_PER_DIR 1000      // Tiny files per directory
+#define GEN_TINY_MAX 4096           // Tiny files are 0..GEN_TINY_MAX-1 bytes
+#define GEN_WRITE_BLOCK (1 << 20)   // Bytes written per call for large files
+#define GEN_SPARSE_SIZE (256LL << 20)    // Apparent size of each sparse file
+#define GEN_SPARSE_EXTENTS 16       // Data extents written into each sparse file
+
+// Shape of the generated tree
+typedef struct {
+	long tiny;                  // Number of tiny files
+	int huge;                   // Number of huge files
+	long long huge_size;        // Bytes per huge file
+	int depth;                  // Levels of the deep directory chain
+	int fifos;                  // Number of FIFOs
+	int sparse;                 // Number of sparse files
+	unsigned long long seed;    // PRNG seed, the same seed gives the same tree
+} gen_params_t;
+
+static unsigned long long rng_state;    // xorshift64* state
+
+static unsigned long long rng_next(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Fill buf with pseudo-random bytes
+static void rng_fill(char *buf, size_t len) {
+	for (size_t i = 0; i < len; i += sizeof(unsigned long long)) {
+		unsigned long long v = rng_next();
+		memcpy(buf + i, &v, len - i < sizeof(v) ? len - i : sizeof(v));
+	}
+}
+
+// Create a directory, an existing one is fine
+static void make_dir(const char *path) {
+	if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Write size pseudo-random bytes to path
+static void write_file(const char *path, long long size, char *buf) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	for (long long done = 0; done < size; ) {
+		size_t want = size - done < GEN_WRITE_BLOCK ? (size_t)(size - done) : GEN_WRITE_BLOCK;
+		rng_fill(buf, want);
+		ssize_t n = write(fd, buf, want);
+		if (n == -1) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		done += n;
+	}
+	close(fd);
+}
+
+// Mostly-hole file: a few data extents spread over GEN_SPARSE_SIZE bytes
+static void write_sparse(const char *path, char *buf) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1 || ftruncate(fd, GEN_SPARSE_SIZE) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < GEN_SPARSE_EXTENTS; i++) {
+		off_t offset = (off_t)(rng_next() % (GEN_SPARSE_SIZE / GEN_WRITE_BLOCK)) * GEN_WRITE_BLOCK;
+		rng_fill(buf, GEN_WRITE_BLOCK);
+		if (pwrite(fd, buf, GEN_WRITE_BLOCK, offset) == -1) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+}
+
+// Build the whole tree under root
+static void generate(const char *root, const gen_params_t *gen) {
+	char path[4096];
+	char *buf = (char *)malloc(GEN_WRITE_BLOCK);
+	if (buf == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	rng_state = gen->seed ? gen->seed : 1;
+	make_dir(root);
+
+	snprintf(path, sizeof(path), "%s/tiny", root);  // Many small files, metadata bound
+	make_dir(path);
+	for (long i = 0; i < gen->tiny; i++) {
+		if (i % GEN_FILES_PER_DIR == 0) {
+			snprintf(path, sizeof(path), "%s/tiny/d%05ld", root, i / GEN_FILES_PER_DIR);
+			make_dir(path);
+		}
+		snprintf(path, sizeof(path), "%s/tiny/d%05ld/f%04ld", root, i / GEN_FILES_PER_DIR, i % GEN_FILES_PER_DIR);
+		write_file(path, (long long)(rng_next() % GEN_TINY_MAX), buf);
+	}
+
+	snprintf(path, sizeof(path), "%s/huge", root);  // Few large files, bandwidth bound
+	make_dir(path);
+	for (int i = 0; i < gen->huge; i++) {
+		snprintf(path, sizeof(path), "%s/huge/huge%d", root, i);
+		write_file(path, gen->huge_size, buf);
+	}
+
+	size_t len = (size_t)snprintf(path, sizeof(path), "%s/deep", root);    // Long chain, path resolution bound
+	make_dir(path);
+	for (int level = 0; level < gen->depth && len + 16 < sizeof(path); level++) {
+		len += (size_t)snprintf(path + len, sizeof(path) - len, "/l%d", level);
+		make_dir(path);
+		char file[sizeof(path) + 8];
+		snprintf(file, sizeof(file), "%s/file", path);
+		write_file(file, (long long)(rng_next() % GEN_TINY_MAX), buf);
+	}
+
+	snprintf(path, sizeof(path), "%s/fifo", root);
+	make_dir(path);
+	for (int i = 0; i < gen->fifos; i++) {
+		snprintf(path, sizeof(path), "%s/fifo/fifo%d", root, i);
+		if (mkfifo(path, 0644) == -1 && errno != EEXIST) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s/sparse", root);
+	make_dir(path);
+	for (int i = 0; i < gen->sparse; i++) {
+		snprintf(path, sizeof(path), "%s/sparse/sparse%d", root, i);
+		write_sparse(path, buf);
+	}
+	free(buf);
+}
+
+// nftw callback: drop the cached pages of a regular file
+static int evict_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+	(void)ftw;
+	if (type == FTW_F && S_ISREG(st->st_mode)) {
+		int fd = open(path, O_RDONLY);
+		if (fd != -1) {
+			fdatasync(fd);  // Dirty pages cannot be dropped
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+	return 0;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [options] <dir>\n", prog);
+	fprintf(stderr, "       %s -e <dir>    drop the page cache of every file under dir (cold cache runs)\n", prog);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -t N      tiny files, %d per directory (default 1000000)\n", GEN_FILES_PER_DIR);
+	fprintf(stderr, "  -H N      huge files (default 2)\n");
+	fprintf(stderr, "  -z SIZE   bytes per huge file, in MiB (default 1024)\n");
+	fprintf(stderr, "  -d N      nesting depth of the deep chain (default 64)\n");
+	fprintf(stderr, "  -f N      FIFOs (default 16)\n");
+	fprintf(stderr, "  -p N      sparse files of %lld MiB apparent size (default 4)\n", GEN_SPARSE_SIZE >> 20);
+	fprintf(stderr, "  -s SEED   PRNG seed (default 1)\n");
+}
+
+int main(int argc, char *argv[]) {
+	gen_params_t gen = {.tiny = 1000000, .huge = 2, .huge_size = 1024LL << 20, .depth = 64, .fifos = 16, .sparse = 4, .seed = 1};
+	int evict = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "et:H:z:d:f:p:s:")) != -1) {
+		switch (opt) {
+			case 'e': evict = 1; break;
+			case 't': gen.tiny = atol(optarg); break;
+			case 'H': gen.huge = atoi(optarg); break;
+			case 'z': gen.huge_size = atoll(optarg) << 20; break;
+			case 'd': gen.depth = atoi(optarg); break;
+			case 'f': gen.fifos = atoi(optarg); break;
+			case 'p': gen.sparse = atoi(optarg); break;
+			case 's': gen.seed = strtoull(optarg, NULL, 0); break;
+			default:
+				usage(argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (argc - optind != 1) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (evict) {
+		return nftw(argv[optind], evict_file, 64, FTW_PHYS) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	generate(argv[optind], &gen);
+	return EXIT_SUCCESS;
+}
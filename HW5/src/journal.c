@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include "journal.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define KEY_DIR 0x44495245435452ULL     // Seeds keep directory, file and chunk keys of one path apart
+#define KEY_FILE 0x46494c45ULL
+#define KEY_CHUNK 0x4348554e4bULL
+
+// First bytes of the journal; tree ties it to one source and destination pair
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t tree;
+} journal_header_t;
+
+// Hash a path below the source root; name is NULL for the directory src_dir itself
+static uint64_t path_key(const journal_t *journal, const char *src_dir, const char *name, uint64_t seed) {
+	char path[MAX_PATH * 2];
+	const char *rel = src_dir + journal->root_len;     // Every directory path starts with the root
+	int len = name != NULL ? snprintf(path, sizeof(path), "%s/%s", rel, name) : snprintf(path, sizeof(path), "%s", rel);
+	if (len >= (int)sizeof(path)) len = (int)sizeof(path) - 1;
+	uint64_t key = checksum64(path, (size_t)len, seed);
+	return key != 0 ? key : 1;  // 0 marks an empty slot
+}
+
+static uint64_t chunk_seed(off_t offset, off_t length) {
+	return KEY_CHUNK ^ ((uint64_t)offset * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)length;
+}
+
+static void set_insert(journal_t *journal, uint64_t key) {
+	size_t mask = journal->capacity - 1;
+	for (size_t slot = key & mask; ; slot = (slot + 1) & mask) {
+		if (journal->done[slot] == key) return;
+		if (journal->done[slot] == 0) {
+			journal->done[slot] = key;
+			journal->loaded++;
+			return;
+		}
+	}
+}
+
+static int set_contains(const journal_t *journal, uint64_t key) {
+	if (journal->capacity == 0) return 0;
+	size_t mask = journal->capacity - 1;
+	for (size_t slot = key & mask; journal->done[slot] != 0; slot = (slot + 1) & mask) {
+		if (journal->done[slot] == key) return 1;
+	}
+	return 0;
+}
+
+// Write out the pending batch; the caller holds the mutex or is the only thread left
+static void flush_pending(journal_t *journal) {
+	const char *data = (const char *)journal->pending;
+	size_t left = journal->pending_count * sizeof(uint64_t);
+	while (left > 0) {
+		ssize_t n = write(journal->fd, data, left);
+		if (n == -1) {
+			perror("journal write");
+			break;
+		}
+		data += n;
+		left -= (size_t)n;
+	}
+	journal->pending_count = 0;
+}
+
+static void append_key(journal_t *journal, uint64_t key) {
+	pthread_mutex_lock(&journal->mutex);
+	journal->pending[journal->pending_count++] = key;
+	journal->written++;
+	if (journal->pending_count == JOURNAL_BUFFER_KEYS) {
+		flush_pending(journal);
+	}
+	pthread_mutex_unlock(&journal->mutex);
+}
+
+// Load the keys of an earlier run into the lookup set. A torn record at the end (the run was
+// killed mid-append) is cut off so new records stay aligned.
+static int load_keys(journal_t *journal, off_t size) {
+	off_t start = (off_t)sizeof(journal_header_t);
+	size_t count = (size_t)(size - start) / sizeof(uint64_t);
+	off_t end = start + (off_t)(count * sizeof(uint64_t));
+	if (end < size && ftruncate(journal->fd, end) == -1) {
+		perror("journal ftruncate");
+		return -1;
+	}
+	if (count == 0) return 0;
+	journal->capacity = 64;
+	while (journal->capacity < count * 2) journal->capacity <<= 1;  // At most half full
+	journal->done = (uint64_t *)calloc(journal->capacity, sizeof(uint64_t));
+	if (journal->done == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for (off_t pos = start; pos < end; ) {
+		size_t want = (size_t)(end - pos) < sizeof(journal->pending) ? (size_t)(end - pos) : sizeof(journal->pending);
+		ssize_t n = pread(journal->fd, journal->pending, want, pos);
+		if (n <= 0) {
+			perror("journal read");
+			return -1;
+		}
+		for (size_t i = 0; i < (size_t)n / sizeof(uint64_t); i++) {
+			set_insert(journal, journal->pending[i]);
+		}
+		pos += n - n % (ssize_t)sizeof(uint64_t);
+	}
+	return 0;
+}
+
+// Open the journal at path. Without resume it starts empty; with resume the keys already in
+// it are loaded and new ones are appended after them. The journal must belong to the same
+// source and destination roots. Returns -1 (after reporting) on failure.
+int journal_open(journal_t *journal, const char *path, const char *src_root, const char *dst_root, int resume) {
+	memset(journal, 0, sizeof(*journal));
+	journal->root_len = strlen(src_root);
+	journal_header_t header = {.magic = JOURNAL_MAGIC, .version = JOURNAL_VERSION,
+			.tree = checksum64(dst_root, strlen(dst_root), checksum64(src_root, journal->root_len, 0))};
+	journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+	struct stat st;
+	if (journal->fd == -1 || fstat(journal->fd, &st) == -1) {
+		perror(path);
+		if (journal->fd != -1) close(journal->fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		if (write(journal->fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+			perror(path);
+			close(journal->fd);
+			return -1;
+		}
+	} else {
+		journal_header_t found;
+		if (pread(journal->fd, &found, sizeof(found), 0) != (ssize_t)sizeof(found) ||
+				found.magic != JOURNAL_MAGIC || found.version != JOURNAL_VERSION) {
+			fprintf(stderr, "%s: not a copy journal\n", path);
+			close(journal->fd);
+			return -1;
+		}
+		if (found.tree != header.tree) {
+			fprintf(stderr, "%s: journal was written for a different source or destination\n", path);
+			close(journal->fd);
+			return -1;
+		}
+		if (load_keys(journal, st.st_size) == -1) {
+			free(journal->done);
+			close(journal->fd);
+			return -1;
+		}
+	}
+	pthread_mutex_init(&journal->mutex, NULL);
+	return 0;
+}
+
+// Append what is still buffered and make the journal durable
+void journal_close(journal_t *journal) {
+	flush_pending(journal);
+	fdatasync(journal->fd);
+	close(journal->fd);
+	free(journal->done);
+	pthread_mutex_destroy(&journal->mutex);
+}
+
+// The earlier run finished this directory and everything below it
+int journal_has_dir(const journal_t *journal, const char *src_dir) {
+	return set_contains(journal, path_key(journal, src_dir, NULL, KEY_DIR));
+}
+
+int journal_has_file(const journal_t *journal, const char *src_dir, const char *name) {
+	return set_contains(journal, path_key(journal, src_dir, name, KEY_FILE));
+}
+
+int journal_has_chunk(const journal_t *journal, const char *src_dir, const char *name, off_t offset, off_t length) {
+	return set_contains(journal, path_key(journal, src_dir, name, chunk_seed(offset, length)));
+}
+
+void journal_dir_done(journal_t *journal, const char *src_dir) {
+	append_key(journal, path_key(journal, src_dir, NULL, KEY_DIR));
+}
+
+void journal_file_done(journal_t *journal, const char *src_dir, const char *name) {
+	append_key(journal, path_key(journal, src_dir, name, KEY_FILE));
+}
+
+void journal_chunk_done(journal_t *journal, const char *src_dir, const char *name, off_t offset, off_t length) {
+	append_key(journal, path_key(journal, src_dir, name, chunk_seed(offset, length)));
+}
@@ -0,0 +1,38 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "task.h"
+
+#define JOURNAL_MAGIC 0x4a355748u   // "HW5J"
+#define JOURNAL_VERSION 1
+#define JOURNAL_BUFFER_KEYS 8192    // Records buffered before one append
+
+// Append-only checkpoint file. Every record is one 64-bit key: the hash of a finished
+// directory subtree, file or chunk path (relative to the source root), so a million files
+// cost 8 MB. Keys are buffered and appended in batches; a run killed without flushing only
+// loses the latest batch, which the resumed run copies again.
+typedef struct journal {
+	int fd;                     // Journal file, opened for appending
+	size_t root_len;            // Length of the source root stripped from recorded paths
+	uint64_t *done;             // Open-addressed set of keys loaded from the previous run
+	size_t capacity;            // Slots in done, a power of two (0 when nothing was loaded)
+	size_t loaded;              // Keys in done
+	pthread_mutex_t mutex;      // Protects the pending batch
+	uint64_t pending[JOURNAL_BUFFER_KEYS];  // Keys not yet written
+	size_t pending_count;       // Keys in pending
+	long long written;          // Keys recorded by this run
+} journal_t;
+
+int journal_open(journal_t *journal, const char *path, const char *src_root, const char *dst_root, int resume);
+void journal_close(journal_t *journal);
+int journal_has_dir(const journal_t *journal, const char *src_dir);
+int journal_has_file(const journal_t *journal, const char *src_dir, const char *name);
+int journal_has_chunk(const journal_t *journal, const char *src_dir, const char *name, off_t offset, off_t length);
+void journal_dir_done(journal_t *journal, const char *src_dir);
+void journal_file_done(journal_t *journal, const char *src_dir, const char *name);
+void journal_chunk_done(journal_t *journal, const char *src_dir, const char *name, off_t offset, off_t length);
+
+#endif //JOURNAL_H
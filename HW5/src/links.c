@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "links.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+
+inode_map_t *inode_map_create(fanout_t *fanout) {
+	inode_map_t *map = (inode_map_t *)calloc(1, sizeof(inode_map_t));
+	if (map == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	map->fanout = fanout;
+	for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+		pthread_mutex_init(&map->locks[i], NULL);
+	}
+	return map;
+}
+
+void inode_map_destroy(inode_map_t *map) {
+	for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+		inode_entry_t *entry = map->buckets[i];
+		while (entry != NULL) {
+			inode_entry_t *next = entry->next;
+			free(entry->dst);
+			free(entry);
+			entry = next;
+		}
+		pthread_mutex_destroy(&map->locks[i]);
+	}
+	free(map);
+}
+
+static size_t bucket_of(dev_t dev, ino_t ino) {
+	uint64_t h = ((uint64_t)ino ^ ((uint64_t)dev << 32)) * 0x9E3779B97F4A7C15ULL;
+	return (size_t)((h ^ (h >> 32)) % HASH_TABLE_SIZE);
+}
+
+// Link name below dst_dirfd to target, replacing a different file of that name (sync runs)
+static int link_name(const char *target, int dst_dirfd, const char *name) {
+	if (linkat(AT_FDCWD, target, dst_dirfd, name, 0) == 0) return 0;
+	if (errno != EEXIST) return -1;
+	struct stat target_stat, name_stat;
+	if (stat(target, &target_stat) == 0 && fstatat(dst_dirfd, name, &name_stat, AT_SYMLINK_NOFOLLOW) == 0 &&
+			target_stat.st_dev == name_stat.st_dev && target_stat.st_ino == name_stat.st_ino) {
+		return 0;   // Already linked by an earlier run
+	}
+	if (unlinkat(dst_dirfd, name, 0) == -1) return -1;
+	return linkat(AT_FDCWD, target, dst_dirfd, name, 0);
+}
+
+// Fan-out: repeat the first name or a later link in every further destination. mirror_fds
+// holds the walker's directory in each of them; target is the first name's primary path.
+static void link_mirrors(inode_map_t *map, const char *target, const int *mirror_fds, const char *name) {
+	char path[MAX_PATH];
+	for (int i = 1; i < map->fanout->count; i++) {
+		int status;
+		if (target == NULL) {   // First name: created now so later links never wait for the copy
+			int fd = openat(mirror_fds[i], name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+			status = fd == -1 ? -1 : close(fd);
+		} else {
+			fanout_path(map->fanout, i, target, path, sizeof(path));
+			status = link_name(path, mirror_fds[i], name);
+		}
+		if (status == -1) {
+			fprintf(stderr, "Could not create %s in %s: %s\n", name, map->fanout->dests[i].root, strerror(errno));
+			fanout_fail(map->fanout, i);
+		}
+	}
+}
+
+// Handle a source file with several links. Returns 1 if an earlier name of the same inode was
+// already seen and name is now a hardlink to its copy; nothing has to be copied. Returns 0 for
+// the first name: it is recorded and its destination created here, under the bucket lock, so
+// later names can link to it at once while a worker fills it in. Returns -1 if name could
+// not be linked; the caller copies it as an ordinary file.
+int inode_map_link(inode_map_t *map, const struct stat *st, int dst_dirfd, const char *dst_dir, const char *name, const int *mirror_fds) {
+	size_t bucket = bucket_of(st->st_dev, st->st_ino);
+	int status = 0;
+	pthread_mutex_lock(&map->locks[bucket]);
+	inode_entry_t *entry = map->buckets[bucket];
+	while (entry != NULL && (entry->dev != st->st_dev || entry->ino != st->st_ino)) {
+		entry = entry->next;
+	}
+	if (entry != NULL) {
+		status = link_name(entry->dst, dst_dirfd, name) == 0 ? 1 : -1;
+		if (status == 1 && map->fanout != NULL) {
+			link_mirrors(map, entry->dst, mirror_fds, name);
+		}
+	} else {
+		char dst[MAX_PATH];
+		snprintf(dst, sizeof(dst), "%s/%s", dst_dir, name);
+		int fd = openat(dst_dirfd, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);    // Keeps existing contents for sync
+		entry = fd != -1 ? (inode_entry_t *)malloc(sizeof(inode_entry_t)) : NULL;
+		if (fd != -1) close(fd);
+		if (entry != NULL && (entry->dst = strdup(dst)) != NULL) {
+			entry->dev = st->st_dev;
+			entry->ino = st->st_ino;
+			entry->next = map->buckets[bucket];
+			map->buckets[bucket] = entry;
+			if (map->fanout != NULL) {
+				link_mirrors(map, NULL, mirror_fds, name);
+			}
+		} else {
+			free(entry);
+			status = -1;
+		}
+	}
+	pthread_mutex_unlock(&map->locks[bucket]);
+	return status;
+}
+
+// Recreate the symlink name below dst_dirfd with the same target. An existing link with the
+// same target is left alone, anything else of that name is replaced.
+int copy_symlink(int src_dirfd, int dst_dirfd, const char *name) {
+	char target[MAX_PATH], existing[MAX_PATH];
+	ssize_t len = readlinkat(src_dirfd, name, target, sizeof(target) - 1);
+	if (len == -1) return -1;
+	target[len] = '\0';
+	if (symlinkat(target, dst_dirfd, name) == 0) return 0;
+	if (errno != EEXIST) return -1;
+	ssize_t existing_len = readlinkat(dst_dirfd, name, existing, sizeof(existing) - 1);
+	if (existing_len == len && memcmp(existing, target, (size_t)len) == 0) return 0;
+	if (unlinkat(dst_dirfd, name, 0) == -1) return -1;
+	return symlinkat(target, dst_dirfd, name);
+}
@@ -0,0 +1,32 @@
+#ifndef LINKS_H
+#define LINKS_H
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "fanout.h"
+#include "task.h"
+
+// First destination name of a source inode with several links
+typedef struct inode_entry {
+	struct inode_entry *next;   // Next entry in the bucket
+	dev_t dev;                  // Source device
+	ino_t ino;                  // Source inode
+	char *dst;                  // Destination path later names are linked to
+} inode_entry_t;
+
+// Concurrent (dev, ino) map shared by the walkers. Only files with st_nlink > 1 go in,
+// so trees without hardlinks never touch it. With fan-out every further destination gets
+// the same links, to its own copy of the first name.
+typedef struct {
+	inode_entry_t *buckets[HASH_TABLE_SIZE];    // Chains of entries
+	pthread_mutex_t locks[HASH_TABLE_SIZE];     // One lock per bucket
+	fanout_t *fanout;           // Further destinations, NULL for one
+} inode_map_t;
+
+inode_map_t *inode_map_create(fanout_t *fanout);
+void inode_map_destroy(inode_map_t *map);
+int inode_map_link(inode_map_t *map, const struct stat *st, int dst_dirfd, const char *dst_dir, const char *name, const int *mirror_fds);
+int copy_symlink(int src_dirfd, int dst_dirfd, const char *name);
+
+#endif //LINKS_H
@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include "meta.h"
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+// Per-thread scratch space for xattr names and values
+typedef struct {
+	char names[META_XATTR_SIZE];
+	char value[META_XATTR_SIZE];
+} meta_scratch_t;
+
+// Queue a job; the ring grows like the walkers' deques
+static void meta_push(meta_t *meta, meta_job_t job) {
+	pthread_mutex_lock(&meta->mutex);
+	if (meta->count == meta->capacity) {
+		size_t capacity = meta->capacity ? meta->capacity * 2 : 1024;
+		meta_job_t *jobs = (meta_job_t *)malloc(sizeof(meta_job_t) * capacity);
+		if (jobs == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < meta->count; i++) {
+			jobs[i] = meta->jobs[(meta->head + i) % meta->capacity];
+		}
+		free(meta->jobs);
+		meta->jobs = jobs;
+		meta->capacity = capacity;
+		meta->head = 0;
+	}
+	meta->jobs[(meta->head + meta->count) % meta->capacity] = job;
+	meta->count++;
+	pthread_cond_signal(&meta->cond);
+	pthread_mutex_unlock(&meta->mutex);
+}
+
+// A file, FIFO or symlink whose data is in place; takes a reference on dir until it is applied
+void meta_add_file(meta_t *meta, dir_ref_t *dir, const char *name, int flags) {
+	dir_ref_get(dir);
+	meta_push(meta, (meta_job_t){.dir = dir, .name = name, .flags = flags});
+}
+
+// The last reference to dir is gone, its subtree is complete. The directory is finalised,
+// then released with dir_ref_finish().
+void meta_add_dir(meta_t *meta, dir_ref_t *dir) {
+	meta_push(meta, (meta_job_t){.dir = dir, .name = NULL, .flags = 0});
+}
+
+// Copy the extended attributes of src to dst. Namespaces the destination refuses
+// (security.* and trusted.* without privileges, filesystems without xattrs) are skipped.
+static int copy_xattrs(const char *src, const char *dst, meta_scratch_t *scratch) {
+	ssize_t len = llistxattr(src, scratch->names, sizeof(scratch->names));
+	if (len == -1) return errno == ENOTSUP ? 0 : -1;
+	int status = 0;
+	for (ssize_t pos = 0; pos < len; pos += (ssize_t)strlen(scratch->names + pos) + 1) {
+		const char *name = scratch->names + pos;
+		ssize_t size = lgetxattr(src, name, scratch->value, sizeof(scratch->value));
+		if (size == -1) {
+			status = -1;
+			continue;
+		}
+		if (lsetxattr(dst, name, scratch->value, (size_t)size, 0) == -1 && errno != ENOTSUP && errno != EPERM) {
+			status = -1;
+		}
+	}
+	return status;
+}
+
+// Give dst the ownership, mode, xattrs and times of src. Ownership comes first since chown
+// clears set-id bits, times last since setting xattrs may touch them on some filesystems.
+// Only root may give files away, so EPERM from chown is not an error.
+static int apply_metadata(const char *src, const char *dst, meta_scratch_t *scratch) {
+	struct stat st;
+	if (lstat(src, &st) == -1) return -1;
+	int status = 0;
+	if (fchownat(AT_FDCWD, dst, st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) == -1 && errno != EPERM) {
+		status = -1;
+	}
+	if (!S_ISLNK(st.st_mode)) {     // Symlink modes are fixed and user xattrs are not allowed on them
+		if (chmod(dst, st.st_mode & 07777) == -1) status = -1;
+		if (copy_xattrs(src, dst, scratch) == -1) status = -1;
+	}
+	struct timespec times[2] = {st.st_atim, st.st_mtim};
+	if (utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW) == -1) {
+		status = -1;
+	}
+	return status;
+}
+
+// Apply one job to every destination and drop what it holds: the file's directory
+// reference, or the directory itself. Each destination counts as an entry of its own.
+static void run_job(meta_t *meta, const meta_job_t *job, meta_scratch_t *scratch) {
+	char src[MAX_PATH], dst[MAX_PATH], mirror[MAX_PATH];
+	if (job->name != NULL) {
+		snprintf(src, sizeof(src), "%s/%s", job->dir->src, job->name);
+		snprintf(dst, sizeof(dst), "%s/%s", job->dir->dst, job->name);
+	} else {
+		snprintf(src, sizeof(src), "%s", job->dir->src);
+		snprintf(dst, sizeof(dst), "%s", job->dir->dst);
+	}
+	int count = meta->fanout != NULL ? meta->fanout->count : 1;
+	for (int i = 0; i < count; i++) {
+		const char *path = dst;
+		if (i > 0) {
+			fanout_path(meta->fanout, i, dst, mirror, sizeof(mirror));
+			path = mirror;
+		}
+		if (apply_metadata(src, path, scratch) == 0) {
+			atomic_fetch_add_explicit(&meta->applied, 1, memory_order_relaxed);
+		} else {
+			atomic_fetch_add_explicit(&meta->failed, 1, memory_order_relaxed);
+			fprintf(stderr, "Could not preserve metadata of %s: %s\n", path, strerror(errno));
+		}
+	}
+	if (job->name == NULL) {
+		dir_ref_put(dir_ref_finish(job->dir));
+		return;
+	}
+	if ((job->flags & META_JOURNAL) && meta->journal != NULL) {
+		journal_file_done(meta->journal, job->dir->src, job->name);
+	}
+	dir_ref_put(job->dir);
+}
+
+// Finaliser thread: applies queued jobs in batches until copying is over and nothing is left.
+// A thread with a batch in hand may still queue directory jobs, so the others wait for it.
+static void *meta_thread(void *arg) {
+	meta_t *meta = (meta_t *)arg;
+	meta_job_t batch[META_BATCH];
+	meta_scratch_t *scratch = (meta_scratch_t *)malloc(sizeof(meta_scratch_t));
+	if (scratch == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_lock(&meta->mutex);
+	for (;;) {
+		while (meta->count == 0 && !(meta->closed && meta->active == 0)) {
+			pthread_cond_wait(&meta->cond, &meta->mutex);
+		}
+		if (meta->count == 0) break;
+		int count = 0;
+		while (meta->count > 0 && count < META_BATCH) {
+			batch[count++] = meta->jobs[meta->head];
+			meta->head = (meta->head + 1) % meta->capacity;
+			meta->count--;
+		}
+		meta->active++;
+		pthread_mutex_unlock(&meta->mutex);
+		for (int i = 0; i < count; i++) {
+			run_job(meta, &batch[i], scratch);
+		}
+		pthread_mutex_lock(&meta->mutex);
+		meta->active--;
+		if (meta->closed && meta->active == 0 && meta->count == 0) {
+			pthread_cond_broadcast(&meta->cond);    // Nothing more can arrive
+		}
+	}
+	pthread_mutex_unlock(&meta->mutex);
+	free(scratch);
+	return NULL;
+}
+
+int meta_start(meta_t *meta, int num_threads, struct journal *journal, fanout_t *fanout) {
+	memset(meta, 0, sizeof(*meta));
+	pthread_mutex_init(&meta->mutex, NULL);
+	pthread_cond_init(&meta->cond, NULL);
+	meta->journal = journal;
+	meta->fanout = fanout;
+	atomic_init(&meta->applied, 0);
+	atomic_init(&meta->failed, 0);
+	meta->threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)num_threads);
+	if (meta->threads == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for (int i = 0; i < num_threads; i++) {
+		if (pthread_create(&meta->threads[i], NULL, meta_thread, meta) != 0) {
+			perror("pthread_create");
+			meta_finish(meta);
+			return -1;
+		}
+		meta->num_threads++;
+	}
+	return 0;
+}
+
+// Called once no copy worker or walker is left: apply everything still queued, including
+// the directories those jobs complete, then stop the threads
+void meta_finish(meta_t *meta) {
+	pthread_mutex_lock(&meta->mutex);
+	meta->closed = 1;
+	pthread_cond_broadcast(&meta->cond);
+	pthread_mutex_unlock(&meta->mutex);
+	for (int i = 0; i < meta->num_threads; i++) {
+		pthread_join(meta->threads[i], NULL);
+	}
+	free(meta->threads);
+	free(meta->jobs);
+	pthread_mutex_destroy(&meta->mutex);
+	pthread_cond_destroy(&meta->cond);
+}
@@ -0,0 +1,50 @@
+#ifndef META_H
+#define META_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "fanout.h"
+#include "task.h"
+
+#define META_DEFAULT_THREADS 2      // Finaliser threads unless --preserve=N says otherwise
+#define META_MAX_THREADS 64         // Upper bound for --preserve=N
+#define META_BATCH 64               // Jobs taken per queue lock
+#define META_XATTR_SIZE 65536       // Largest xattr name list and value (XATTR_SIZE_MAX)
+
+#define META_JOURNAL 0x1            // Journal the file as finished once its metadata is applied
+
+// One entry waiting for its metadata. A file job holds a reference on its directory; a
+// directory job is the directory itself, handed over by its last dir_ref_put().
+typedef struct {
+	dir_ref_t *dir;             // Directory of the entry, or the directory being finalised
+	const char *name;           // Leaf name in dir's arena, NULL for the directory itself
+	int flags;                  // META_* flags
+} meta_job_t;
+
+// Metadata finalisation stage. Mode, ownership, xattrs and timestamps are copied from the
+// source by a small pool of threads once an entry's data has landed, so the copy workers do
+// not pay for those syscalls. A directory is only finalised after its whole subtree, so
+// creating its entries cannot touch its mtime again and a read-only mode is set last.
+typedef struct meta {
+	pthread_mutex_t mutex;      // Protects the queue, closed and active
+	pthread_cond_t cond;        // Signaled when jobs arrive or the stage may end
+	meta_job_t *jobs;           // Ring of queued jobs
+	size_t capacity;            // Allocated jobs
+	size_t head;                // Oldest job
+	size_t count;               // Queued jobs
+	int closed;                 // Copying is over, threads exit once everything is applied
+	int active;                 // Threads applying a batch, which may queue directory jobs
+	int num_threads;            // Finaliser threads
+	pthread_t *threads;         // Finaliser threads
+	struct journal *journal;    // Records finished files after their metadata, NULL when not journaling
+	fanout_t *fanout;           // Further destinations that get the same metadata, NULL for one
+	atomic_llong applied;       // Entries finalised
+	atomic_llong failed;        // Entries whose metadata could not be fully applied
+} meta_t;
+
+int meta_start(meta_t *meta, int num_threads, struct journal *journal, fanout_t *fanout);
+void meta_add_file(meta_t *meta, dir_ref_t *dir, const char *name, int flags);
+void meta_add_dir(meta_t *meta, dir_ref_t *dir);
+void meta_finish(meta_t *meta);
+
+#endif //META_H
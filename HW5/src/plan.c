@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include "plan.h"
+#include "stats.h"
+#include "task.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+// One calibration thread's share of a phase
+typedef struct {
+	plan_t *plan;               // Samples to copy
+	copy_ctx_t *ctx;            // Worker copy settings and buffer
+	const char *dir;            // Scratch directory
+	int index;                  // This thread
+	int count;                  // Threads in the phase
+	int stream;                 // Copying a slice of the largest file rather than samples
+	int status;                 // -1 if any copy failed
+} calibration_t;
+
+void plan_init(plan_t *plan) {
+	memset(plan, 0, sizeof(*plan));
+	pthread_mutex_init(&plan->mutex, NULL);
+	for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+		pthread_mutex_init(&plan->inode_locks[i], NULL);
+	}
+	atomic_init(&plan->linked_names, 0);
+}
+
+void plan_destroy(plan_t *plan) {
+	for (int i = 0; i < plan->num_samples; i++) {
+		free(plan->samples[i]);
+	}
+	free(plan->largest);
+	for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+		plan_inode_t *inode = plan->inodes[i];
+		while (inode != NULL) {
+			plan_inode_t *next = inode->next;
+			free(inode);
+			inode = next;
+		}
+		pthread_mutex_destroy(&plan->inode_locks[i]);
+	}
+	pthread_mutex_destroy(&plan->mutex);
+}
+
+// Record a source inode with several links, as the copy's inode map would. Returns 1 if an
+// earlier name of it was already sized: the copy links this one, so it adds nothing to plan.
+int plan_link_seen(plan_t *plan, dev_t dev, ino_t ino) {
+	uint64_t h = ((uint64_t)ino ^ ((uint64_t)dev << 32)) * 0x9E3779B97F4A7C15ULL;
+	size_t bucket = (size_t)((h ^ (h >> 32)) % HASH_TABLE_SIZE);
+	int seen = 0;
+	pthread_mutex_lock(&plan->inode_locks[bucket]);
+	plan_inode_t *inode = plan->inodes[bucket];
+	while (inode != NULL && (inode->dev != dev || inode->ino != ino)) {
+		inode = inode->next;
+	}
+	if (inode != NULL) {
+		seen = 1;
+		atomic_fetch_add_explicit(&plan->linked_names, 1, memory_order_relaxed);
+	} else if ((inode = (plan_inode_t *)malloc(sizeof(plan_inode_t))) != NULL) {
+		inode->dev = dev;
+		inode->ino = ino;
+		inode->next = plan->inodes[bucket];
+		plan->inodes[bucket] = inode;
+	}
+	pthread_mutex_unlock(&plan->inode_locks[bucket]);
+	return seen;
+}
+
+// Same classes as the largest-first scheduler, with everything past the last folded into it
+int plan_class(long long size) {
+	int class = size <= 0 ? 0 : 64 - __builtin_clzll((unsigned long long)size);
+	return class < PLAN_CLASSES ? class : PLAN_CLASSES - 1;
+}
+
+// Fold a walker's histogram and allocated bytes in when it exits
+void plan_add(plan_t *plan, const long long *files, const long long *bytes, long long data) {
+	pthread_mutex_lock(&plan->mutex);
+	plan->data_bytes += data;
+	for (int i = 0; i < PLAN_CLASSES; i++) {
+		plan->files[i] += files[i];
+		plan->bytes[i] += bytes[i];
+	}
+	pthread_mutex_unlock(&plan->mutex);
+}
+
+void plan_offer_sample(plan_t *plan, const char *path, long long size) {
+	pthread_mutex_lock(&plan->mutex);
+	if (plan->num_samples < PLAN_SAMPLE_FILES && (plan->samples[plan->num_samples] = strdup(path)) != NULL) {
+		plan->sample_sizes[plan->num_samples++] = size;
+	}
+	pthread_mutex_unlock(&plan->mutex);
+}
+
+// Walkers only offer a file when it beats their own largest, so this lock is rarely taken
+void plan_offer_largest(plan_t *plan, const char *path, long long size) {
+	pthread_mutex_lock(&plan->mutex);
+	char *copy;
+	if (size > plan->largest_size && (copy = strdup(path)) != NULL) {
+		free(plan->largest);
+		plan->largest = copy;
+		plan->largest_size = size;
+	}
+	pthread_mutex_unlock(&plan->mutex);
+}
+
+// Copy this thread's share: every count-th sample, or one slice of the largest file's head
+static void *calibration_thread(void *arg) {
+	calibration_t *c = (calibration_t *)arg;
+	plan_t *plan = c->plan;
+	char dst[MAX_PATH];
+	copy_result_t result;
+	if (c->stream) {
+		long long total = plan->largest_size < PLAN_STREAM_BYTES ? plan->largest_size : PLAN_STREAM_BYTES;
+		long long offset = total * c->index / c->count;
+		long long end = total * (c->index + 1) / c->count;
+		snprintf(dst, sizeof(dst), "%s/stream", c->dir);
+		if (end > offset && copy_file_part(plan->largest, dst, offset, end - offset, c->ctx, &result) == -1) {
+			c->status = -1;
+		}
+		return NULL;
+	}
+	for (int i = c->index; i < plan->num_samples; i += c->count) {
+		snprintf(dst, sizeof(dst), "%s/%d", c->dir, i);
+		if (copy_file(plan->samples[i], dst, c->ctx, &result) == -1) {
+			c->status = -1;
+		}
+	}
+	return NULL;
+}
+
+// Run one phase on count threads; returns its wall time in seconds, or -1 if a copy failed
+static double run_phase(plan_t *plan, const char *dir, copy_ctx_t *const *ctxs, int count, int stream) {
+	pthread_t threads[count];
+	calibration_t args[count];
+	long long start = stats_now_ns();
+	int started = 0;
+	for (int i = 0; i < count; i++) {
+		args[i] = (calibration_t){.plan = plan, .ctx = ctxs[i], .dir = dir, .index = i, .count = count, .stream = stream};
+		if (pthread_create(&threads[i], NULL, calibration_thread, &args[i]) != 0) {
+			perror("pthread_create");
+			args[i].status = -1;
+			break;
+		}
+		started++;
+	}
+	int status = started == count ? 0 : -1;
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+		if (args[i].status == -1) status = -1;
+	}
+	return status == 0 ? (stats_now_ns() - start) / 1e9 : -1;
+}
+
+// Time the sample copies into a scratch directory under dst_dir with count workers' settings,
+// then remove it. Streaming goes first so the sample phase's byte share can be priced out.
+// Returns -1 if calibration could not run; the histogram is still valid.
+int plan_calibrate(plan_t *plan, const char *dst_dir, copy_ctx_t *const *ctxs, int count) {
+	if (plan->largest == NULL) return 0;   // No dense regular file with data, nothing to price
+	char dir[MAX_PATH];
+	snprintf(dir, sizeof(dir), "%s/.plan-XXXXXX", dst_dir);
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return -1;
+	}
+	plan->threads = count;
+	char stream[MAX_PATH + 16];
+	snprintf(stream, sizeof(stream), "%s/stream", dir);
+	plan->stream_bytes = plan->largest_size < PLAN_STREAM_BYTES ? plan->largest_size : PLAN_STREAM_BYTES;
+	int fd = open(stream, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);   // The slices write into one sized file
+	if (fd == -1 || ftruncate(fd, plan->stream_bytes) == -1) {
+		perror("open calibration file");
+	} else {
+		plan->stream_s = run_phase(plan, dir, ctxs, count, 1);
+	}
+	if (fd != -1) close(fd);
+	unlink(stream);
+	for (int i = 0; i < plan->num_samples; i++) {
+		plan->sample_bytes += plan->sample_sizes[i];
+	}
+	if (plan->num_samples > 0) {
+		plan->sample_s = run_phase(plan, dir, ctxs, count < plan->num_samples ? count : plan->num_samples, 0);
+	}
+	char path[MAX_PATH + 16];
+	for (int i = 0; i < plan->num_samples; i++) {
+		snprintf(path, sizeof(path), "%s/%d", dir, i);
+		unlink(path);
+	}
+	if (rmdir(dir) == -1) {
+		perror(dir);
+	}
+	plan->calibrated = plan->stream_s > 0 && plan->sample_s >= 0;
+	return plan->calibrated ? 0 : -1;
+}
+
+// Predicted copy time in seconds: what the samples took beyond their bytes is per-file
+// overhead, the allocated bytes move at the streaming rate. -1 without a calibration.
+double plan_predict(const plan_t *plan) {
+	if (!plan->calibrated) return -1;
+	long long files = 0;
+	for (int i = 0; i < PLAN_CLASSES; i++) {
+		files += plan->files[i];
+	}
+	double byte_s = plan->stream_s / (double)plan->stream_bytes;
+	double file_s = 0;
+	if (plan->num_samples > 0) {
+		file_s = (plan->sample_s - plan->sample_bytes * byte_s) / plan->num_samples;
+		if (file_s < 0) file_s = 0;
+	}
+	return files * file_s + plan->data_bytes * byte_s;
+}
+
+// Human readable upper bound of a size class
+static void format_size(long long size, char *out, size_t length) {
+	const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB"};
+	int unit = 0;
+	while (size >= 1024 && unit < 5) {
+		size /= 1024;
+		unit++;
+	}
+	snprintf(out, length, "%lld %s", size, units[unit]);
+}
+
+void plan_print(const plan_t *plan, double walk_s, int entries) {
+	long long files = 0, bytes = 0;
+	for (int i = 0; i < PLAN_CLASSES; i++) {
+		files += plan->files[i];
+		bytes += plan->bytes[i];
+	}
+	printf("\n---------------PLAN--------------------\n");
+	printf("Regular Files: %lld, %lld bytes (%lld allocated), walked in %.3f s (%.0f entries/s)\n", files, bytes,
+			plan->data_bytes, walk_s, walk_s > 0 ? entries / walk_s : 0.0);
+	long long linked = atomic_load(&plan->linked_names);
+	if (linked > 0) {
+		printf("Hardlinked Names: %lld, linked to their first name rather than copied\n", linked);
+	}
+	printf("  %-12s %12s %16s\n", "size below", "files", "bytes");
+	for (int i = 0; i < PLAN_CLASSES; i++) {
+		if (plan->files[i] == 0) continue;
+		char bound[32];
+		if (i == 0) {
+			snprintf(bound, sizeof(bound), "empty");
+		} else if (i == PLAN_CLASSES - 1) {
+			snprintf(bound, sizeof(bound), "larger");
+		} else {
+			format_size(1LL << i, bound, sizeof(bound));
+		}
+		printf("  %-12s %12lld %16lld\n", bound, plan->files[i], plan->bytes[i]);
+	}
+	if (!plan->calibrated) {
+		printf("Predicted Copy Time: unknown, no calibration\n");
+		return;
+	}
+	double byte_s = plan->stream_s / (double)plan->stream_bytes;
+	printf("Calibration: %lld bytes of the largest dense file in %.3f s (%.1f MB/s), %d small files in %.3f s, %d workers\n",
+			plan->stream_bytes, plan->stream_s, byte_s > 0 ? 1e-6 / byte_s : 0.0, plan->num_samples, plan->sample_s, plan->threads);
+	double predicted = plan_predict(plan);
+	double total = predicted > walk_s ? predicted : walk_s;     // The walk overlaps the copy
+	long ms = (long)(total * 1000);
+	printf("Predicted Copy Time: %02ld:%02ld.%03ld (min:sec.mili)\n", ms / 60000, ms / 1000 % 60, ms % 1000);
+}
+
+void plan_write_json(const plan_t *plan, FILE *out) {
+	fprintf(out, "  \"plan\": {\"predicted_us\": %lld, \"data_bytes\": %lld, \"linked_names\": %lld, \"histogram\": [",
+			plan->calibrated ? (long long)(plan_predict(plan) * 1e6) : -1, plan->data_bytes, (long long)atomic_load(&plan->linked_names));
+	int first = 1;
+	for (int i = 0; i < PLAN_CLASSES; i++) {
+		if (plan->files[i] == 0) continue;
+		fprintf(out, "%s\n    {\"below\": %lld, \"files\": %lld, \"bytes\": %lld}", first ? "" : ",",
+				i == 0 ? 1LL : 1LL << i, plan->files[i], plan->bytes[i]);
+		first = 0;
+	}
+	fprintf(out, "\n  ]},\n");
+}
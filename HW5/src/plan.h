@@ -0,0 +1,65 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "copy_engine.h"
+#include "task.h"
+
+#define PLAN_CLASSES 48             // Class i holds sizes in [2^(i-1), 2^i), class 0 empty files
+#define PLAN_SAMPLE_FILES 256       // Small files copied to price the per-file overhead
+#define PLAN_SAMPLE_STRIDE 32       // A walker offers every this many small files as a sample
+#define PLAN_SMALL (1LL << 20)      // Samples are files below this size
+#define PLAN_STREAM_BYTES (256LL << 20)     // Bytes of the largest file copied to price throughput
+#define PLAN_WALKERS_PER_CPU 2      // Default walkers in plan mode; statx waits on the disk, not the CPU
+
+// A source inode with several links whose first name the planner already sized
+typedef struct plan_inode {
+	struct plan_inode *next;    // Next entry in the bucket
+	dev_t dev;                  // Source device
+	ino_t ino;                  // Source inode
+} plan_inode_t;
+
+// Dry-run planner. Walkers only statx regular files for their size and fold counts into a
+// log2 size histogram; nothing is created or queued. Along the way they offer a spread of
+// small files and the largest dense file as calibration samples. plan_calibrate() then copies
+// those into a scratch directory under the destination with the real workers' settings, and
+// the result prices the whole tree as per-file overhead plus allocated bytes over streaming
+// throughput. A sparse sample would time mostly holes, which are skipped rather than copied.
+// Later names of a hardlinked inode are counted apart: the copy links them, moving no data.
+typedef struct {
+	pthread_mutex_t mutex;      // Protects everything below
+	long long files[PLAN_CLASSES];  // Regular files per size class
+	long long bytes[PLAN_CLASSES];  // Their bytes
+	long long data_bytes;       // Bytes the files have allocated; holes are skipped by the copy
+	char *samples[PLAN_SAMPLE_FILES];   // Paths of the small sample files
+	long long sample_sizes[PLAN_SAMPLE_FILES];
+	int num_samples;
+	char *largest;              // Path of the largest file without holes, NULL if none
+	long long largest_size;
+	int threads;                // Workers used for calibration
+	long long sample_bytes;     // Bytes of the samples copied
+	double sample_s;            // Wall time copying the samples
+	long long stream_bytes;     // Bytes of the largest file copied
+	double stream_s;            // Wall time copying them
+	int calibrated;             // Both phases succeeded
+	plan_inode_t *inodes[HASH_TABLE_SIZE];      // Inodes with several links sized so far
+	pthread_mutex_t inode_locks[HASH_TABLE_SIZE];   // One lock per bucket
+	atomic_llong linked_names;  // Further names of those inodes, left out of the histogram
+} plan_t;
+
+void plan_init(plan_t *plan);
+void plan_destroy(plan_t *plan);
+int plan_class(long long size);
+void plan_add(plan_t *plan, const long long *files, const long long *bytes, long long data);
+int plan_link_seen(plan_t *plan, dev_t dev, ino_t ino);
+void plan_offer_sample(plan_t *plan, const char *path, long long size);
+void plan_offer_largest(plan_t *plan, const char *path, long long size);
+int plan_calibrate(plan_t *plan, const char *dst_dir, copy_ctx_t *const *ctxs, int count);
+double plan_predict(const plan_t *plan);
+void plan_print(const plan_t *plan, double walk_s, int entries);
+void plan_write_json(const plan_t *plan, FILE *out);
+
+#endif //PLAN_H
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include "pool.h"
+#include "copier.h"
+#include <stdio.h>
+#include <time.h>
+
+// Aggregate progress of all workers at one instant
+typedef struct {
+	long long t_ns;             // Sample time
+	long long bytes;            // Bytes written so far
+	long long files;            // Files finished so far
+	long long latency_ns;       // Sum of per-file latencies so far
+} pool_sample_t;
+
+static void take_sample(thread_params_t *params, pool_sample_t *sample) {
+	sample->t_ns = stats_now_ns();
+	sample->bytes = sample->files = sample->latency_ns = 0;
+	for (int i = 0; i < params->num_workers; i++) {
+		worker_stats_t *s = &params->worker_stats[i];
+		sample->bytes += atomic_load_explicit(&s->bytes, memory_order_relaxed);
+		sample->files += atomic_load_explicit(&s->files, memory_order_relaxed);
+		sample->latency_ns += atomic_load_explicit(&s->latency_ns, memory_order_relaxed);
+	}
+}
+
+static void set_active(worker_pool_t *pool, int active) {
+	pthread_mutex_lock(&pool->mutex);
+	atomic_store(&pool->active, active);
+	pthread_cond_broadcast(&pool->cond);    // Parked workers recheck their index
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+// Hill climbing on aggregate throughput: keep moving while bytes/s improves, turn around
+// when it drops. Workers sleeping on an empty queue mean the walkers are the bottleneck, so
+// extra workers only burn CPU; a full queue or rising latency at flat throughput steer the search.
+static void *tuner_thread(void *arg) {
+	worker_pool_t *pool = (worker_pool_t *)arg;
+	thread_params_t *params = pool->params;
+	struct timespec interval = {.tv_sec = POOL_INTERVAL_MS / 1000, .tv_nsec = (POOL_INTERVAL_MS % 1000) * 1000000L};
+	pool_sample_t prev, now;
+	take_sample(params, &prev);
+	double prev_rate = -1;      // Bytes/s of the previous period, -1 before the first
+	double prev_latency = 0;    // Mean latency of the previous period in ms
+	int direction = 1;          // Last move, +1 grows the pool
+	while (!atomic_load(&pool->stop)) {
+		nanosleep(&interval, NULL);
+		if (termination_flag && !atomic_load(&pool->released)) {
+			pool_release(pool);     // Wake parked workers so they can exit
+		}
+		if (atomic_load(&pool->released)) continue;     // Draining, sizes no longer matter
+		take_sample(params, &now);
+		double seconds = (now.t_ns - prev.t_ns) / 1e9;
+		double rate = (now.bytes - prev.bytes) / seconds;
+		long long files = now.files - prev.files;
+		double latency = files > 0 ? (now.latency_ns - prev.latency_ns) / 1e6 / files : prev_latency;
+		int depth = buffer_count(params->buffer);
+		int active = atomic_load(&pool->active);
+		int step = active / 4 > 1 ? active / 4 : 1;
+		int next = active;
+		const char *reason = "";
+
+		int starved = depth == 0 && atomic_load(&params->buffer->empty_waiters) > 0;
+		if (files == 0 && depth == 0) {
+			// Nothing finished or queued yet, keep the current size
+		} else if (starved) {
+			next = active - step;
+			direction = -1;
+			reason = "queue empty, walkers are the bottleneck";
+		} else if (prev_rate < 0) {
+			next = active + step;
+			direction = 1;
+			reason = "probing";
+		} else if (rate > prev_rate * (1 + POOL_GAIN)) {
+			next = active + direction * step;
+			reason = "throughput up, keep going";
+		} else if (rate < prev_rate * (1 - POOL_GAIN)) {
+			direction = -direction;
+			next = active + direction * step;
+			reason = "throughput down, reverse";
+		} else if (prev_latency > 0 && latency > prev_latency * POOL_LATENCY_RISE) {
+			direction = -1;
+			next = active - step;
+			reason = "throughput flat, latency up";
+		} else if (depth >= params->buffer_size * 3 / 4) {
+			direction = 1;
+			next = active + step;
+			reason = "throughput flat, queue backing up";
+		}
+		if (next < 1) next = 1;
+		if (next > params->num_workers) next = params->num_workers;
+
+		if (next != active) {
+			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
+			printf("Auto workers: %d -> %d (%.1f MiB/s, %.1f MiB/s per worker, queue %d, latency %.2f ms): %s\n",
+					active, next, rate / 1048576, rate / 1048576 / active, depth, latency, reason);
+			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
+			set_active(pool, next);
+		}
+		prev = now;
+		prev_rate = rate;
+		prev_latency = latency;
+	}
+	return NULL;
+}
+
+// Start the tuner with `initial` active workers
+int pool_start(worker_pool_t *pool, thread_params_t *params, int initial) {
+	pool->params = params;
+	atomic_init(&pool->active, initial);
+	atomic_init(&pool->released, 0);
+	atomic_init(&pool->stop, 0);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	return pthread_create(&pool->thread, NULL, tuner_thread, pool) == 0 ? 0 : -1;
+}
+
+// No more tasks will be added: let parked workers leave, the active ones drain the buffer
+void pool_release(worker_pool_t *pool) {
+	pthread_mutex_lock(&pool->mutex);
+	atomic_store(&pool->released, 1);
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+// Stop the tuner once the workers are joined
+void pool_stop(worker_pool_t *pool) {
+	atomic_store(&pool->stop, 1);
+	pthread_join(pool->thread, NULL);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->cond);
+}
+
+// Called by worker `id` before taking tasks. Parks while the worker is outside the active
+// set; returns 0 when the worker should exit because the pool was released while it was parked.
+int pool_wait_active(worker_pool_t *pool, int id) {
+	if (id < atomic_load(&pool->active)) return 1;
+	pthread_mutex_lock(&pool->mutex);
+	while (id >= atomic_load(&pool->active) && !atomic_load(&pool->released) && !termination_flag) {
+		pthread_cond_wait(&pool->cond, &pool->mutex);
+	}
+	int run = id < atomic_load(&pool->active);
+	pthread_mutex_unlock(&pool->mutex);
+	return run;
+}
@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define POOL_INTERVAL_MS 250        // Tuning period
+#define POOL_CPU_FACTOR 4           // Auto mode starts up to this many workers per CPU
+#define POOL_MAX_WORKERS 64         // Upper bound for auto mode
+#define POOL_GAIN 0.05              // Relative throughput change treated as real
+#define POOL_LATENCY_RISE 1.25      // Latency growth that counts as device saturation
+
+struct thread_params;
+
+// Auto mode: every worker thread exists, but only the first `active` take tasks. A tuner
+// thread hill-climbs `active` towards the highest aggregate bytes/s.
+typedef struct worker_pool {
+	struct thread_params *params;   // Shared thread parameters
+	atomic_int active;          // Workers allowed to take tasks
+	atomic_int released;        // Manager is done: parked workers exit, tuner stops resizing
+	atomic_int stop;            // Tuner shutdown
+	pthread_mutex_t mutex;      // Protects parking
+	pthread_cond_t cond;        // Signaled when active grows or the pool is released
+	pthread_t thread;           // Tuner thread
+} worker_pool_t;
+
+int pool_start(worker_pool_t *pool, struct thread_params *params, int initial);
+void pool_release(worker_pool_t *pool);
+void pool_stop(worker_pool_t *pool);
+int pool_wait_active(worker_pool_t *pool, int id);
+
+#endif //POOL_H
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include "progress.h"
+#include "copier.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+// Format seconds as h:mm:ss or m:ss
+static void format_eta(double seconds, char *out, size_t size) {
+	long s = (long)(seconds + 0.5);
+	if (s >= 3600) {
+		snprintf(out, size, "%ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+	} else {
+		snprintf(out, size, "%ld:%02ld", s / 60, s % 60);
+	}
+}
+
+// Print one report from the counters as they are right now
+static void report(progress_t *progress, long long elapsed_ns, long long files, long long bytes,
+		double file_rate, double byte_rate) {
+	thread_params_t *params = progress->params;
+	long long found_files = atomic_load_explicit(&params->found_files, memory_order_relaxed);
+	long long found_bytes = atomic_load_explicit(&params->found_bytes, memory_order_relaxed);
+	int walking = !atomic_load_explicit(&params->walk_done, memory_order_relaxed);
+	char eta[32] = "--:--";
+	if (byte_rate > 0 && found_bytes >= bytes) {
+		format_eta((double)(found_bytes - bytes) / byte_rate, eta, sizeof(eta));
+	}
+	fprintf(stderr, "%s%7.1fs  %lld/%lld%s files  %.1f/%.1f%s MB  %.0f files/s  %.1f MB/s  queue %d/%d  ETA %s%s%s",
+			progress->tty ? "\r" : "", elapsed_ns / 1e9, files, found_files, walking ? "+" : "",
+			bytes / 1e6, found_bytes / 1e6, walking ? "+" : "", file_rate, byte_rate / 1e6,
+			buffer_count(params->buffer), params->buffer->capacity, walking ? ">" : "", eta,
+			progress->tty ? "\033[K" : "\n");
+	fflush(stderr);
+}
+
+static void *progress_thread(void *arg) {
+	progress_t *progress = (progress_t *)arg;
+	thread_params_t *params = progress->params;
+	long long start = stats_now_ns();
+	long long last = start, last_files = 0, last_bytes = 0;
+	double file_rate = 0, byte_rate = 0;
+	pthread_mutex_lock(&progress->mutex);
+	while (!progress->stop) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += progress->interval_ms / 1000;
+		deadline.tv_nsec += (progress->interval_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (!progress->stop && pthread_cond_timedwait(&progress->cond, &progress->mutex, &deadline) == 0) {
+		}
+		if (progress->stop) break;
+		pthread_mutex_unlock(&progress->mutex);
+
+		long long files = 0, bytes = 0;
+		for (int i = 0; i < params->num_workers; i++) {
+			files += atomic_load_explicit(&params->worker_stats[i].done_files, memory_order_relaxed);
+			bytes += atomic_load_explicit(&params->worker_stats[i].done_bytes, memory_order_relaxed);
+		}
+		long long now = stats_now_ns();
+		double seconds = (now - last) / 1e9;
+		double files_now = (files - last_files) / seconds, bytes_now = (bytes - last_bytes) / seconds;
+		file_rate = last == start ? files_now : PROGRESS_SMOOTHING * files_now + (1 - PROGRESS_SMOOTHING) * file_rate;
+		byte_rate = last == start ? bytes_now : PROGRESS_SMOOTHING * bytes_now + (1 - PROGRESS_SMOOTHING) * byte_rate;
+		last = now;
+		last_files = files;
+		last_bytes = bytes;
+		report(progress, now - start, files, bytes, file_rate, byte_rate);
+
+		pthread_mutex_lock(&progress->mutex);
+	}
+	pthread_mutex_unlock(&progress->mutex);
+	if (progress->tty && last != start) {
+		fputc('\n', stderr);    // Keep the last report above the statistics
+	}
+	return NULL;
+}
+
+int progress_start(progress_t *progress, struct thread_params *params, int interval_ms) {
+	memset(progress, 0, sizeof(*progress));
+	progress->params = params;
+	progress->interval_ms = interval_ms;
+	progress->tty = isatty(STDERR_FILENO);
+	pthread_mutex_init(&progress->mutex, NULL);
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);  // Deadlines from the same clock as stats_now_ns
+	pthread_cond_init(&progress->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&progress->thread, NULL, progress_thread, progress) != 0) {
+		perror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+// Stop at once instead of sleeping out the interval
+void progress_stop(progress_t *progress) {
+	pthread_mutex_lock(&progress->mutex);
+	progress->stop = 1;
+	pthread_cond_signal(&progress->cond);
+	pthread_mutex_unlock(&progress->mutex);
+	pthread_join(progress->thread, NULL);
+	pthread_mutex_destroy(&progress->mutex);
+	pthread_cond_destroy(&progress->cond);
+}
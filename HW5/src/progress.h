@@ -0,0 +1,28 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <pthread.h>
+
+#define PROGRESS_DEFAULT_MS 1000    // Report interval when stderr is a terminal
+#define PROGRESS_SMOOTHING 0.5      // Weight of the newest interval in the rates
+
+struct thread_params;
+
+// Reporter thread printing throughput, queue depth and an ETA to stderr. It only reads
+// relaxed atomics: the walkers' discovered totals and the workers' per-shard counters, so
+// the copy threads never wait on it. The ETA divides the bytes found so far but not yet
+// done by the smoothed byte rate; while the walk is still running it is a lower bound.
+typedef struct {
+	pthread_t thread;           // Reporter
+	struct thread_params *params;   // Counters to read
+	int interval_ms;            // Time between reports
+	int tty;                    // Redraw one line in place instead of printing a line per report
+	int stop;                   // Set to end reporting
+	pthread_mutex_t mutex;      // Protects stop
+	pthread_cond_t cond;        // Wakes the reporter early to stop
+} progress_t;
+
+int progress_start(progress_t *progress, struct thread_params *params, int interval_ms);
+void progress_stop(progress_t *progress);
+
+#endif //PROGRESS_H
@@ -0,0 +1,167 @@
+#include "schedule.h"
+#include "copier.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Map a command line schedule name to its enum value
+int parse_sched_mode(const char *name, sched_mode_t *mode) {
+	if (strcmp(name, "fifo") == 0) {
+		*mode = SCHEDULE_FIFO;
+	} else if (strcmp(name, "largest") == 0) {
+		*mode = SCHEDULE_LARGEST;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+int sched_init(sched_t *sched, buffer_t *buffer, int batch_size, int num_workers) {
+	memset(sched, 0, sizeof(*sched));
+	sched->buffer = buffer;
+	sched->batch_size = batch_size;
+	sched->num_workers = num_workers > 0 ? num_workers : 1;
+	sched->loads = (long long *)calloc((size_t)sched->num_workers, sizeof(long long));
+	if (sched->loads == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	pthread_mutex_init(&sched->mutex, NULL);
+	pthread_cond_init(&sched->cond, NULL);
+	return 0;
+}
+
+void sched_destroy(sched_t *sched) {
+	for (int i = 0; i < SCHEDULE_CLASSES; i++) {
+		free(sched->classes[i].tasks);
+		free(sched->classes[i].sizes);
+	}
+	free(sched->loads);
+	pthread_mutex_destroy(&sched->mutex);
+	pthread_cond_destroy(&sched->cond);
+}
+
+// Class 0 holds empty files, class i sizes in [2^(i-1), 2^i)
+static int class_of(long long size) {
+	return size <= 0 ? 0 : 64 - __builtin_clzll((unsigned long long)size);
+}
+
+// Replay a dispatched task as list scheduling: it lands on the least loaded simulated worker
+static void simulate(sched_t *sched, long long cost) {
+	int least = 0;
+	for (int i = 1; i < sched->num_workers; i++) {
+		if (sched->loads[i] < sched->loads[least]) least = i;
+	}
+	sched->loads[least] += cost;
+	sched->total_cost += cost;
+	if (cost > sched->largest_cost) sched->largest_cost = cost;
+}
+
+// Dispatcher thread: moves the largest pending task (or a batch of the largest small ones)
+// into the buffer. buffer_add_batch blocks while the buffer is full, and every task that
+// arrives meanwhile competes for the next slot by size.
+static void *dispatcher_thread(void *arg) {
+	sched_t *sched = (sched_t *)arg;
+	file_info_t batch[TASK_BATCH_MAX];
+	for (;;) {
+		pthread_mutex_lock(&sched->mutex);
+		while (sched->pending == 0 && !sched->closed) {
+			pthread_cond_wait(&sched->cond, &sched->mutex);
+		}
+		if (sched->pending == 0) {
+			pthread_mutex_unlock(&sched->mutex);
+			break;      // Walk over and everything dispatched
+		}
+		int top = SCHEDULE_CLASSES - 1;
+		while (sched->classes[top].count == 0) top--;
+		int limit = top > 0 && (1LL << (top - 1)) >= SCHEDULE_SMALL ? 1 : sched->batch_size;   // Large tasks go out one by one
+		int count = 0;
+		long long cost = 0;
+		for (int c = top; c >= 0 && count < limit; c--) {
+			sched_class_t *class = &sched->classes[c];
+			while (class->count > 0 && count < limit) {
+				class->count--;
+				batch[count++] = class->tasks[class->count];
+				cost += class->sizes[class->count] + SCHEDULE_FILE_COST;
+			}
+		}
+		sched->pending -= (size_t)count;
+		pthread_mutex_unlock(&sched->mutex);
+
+		if (termination_flag) {
+			for (int i = 0; i < count; i++) {
+				drop_task(&batch[i]);
+			}
+			continue;
+		}
+		if (sched->first_ns == 0) {
+			sched->first_ns = stats_now_ns();
+		}
+		simulate(sched, cost);
+		sched->tasks += count;
+		buffer_add_batch(sched->buffer, batch, count);
+	}
+	return NULL;
+}
+
+int sched_start(sched_t *sched) {
+	if (pthread_create(&sched->thread, NULL, dispatcher_thread, sched) != 0) {
+		perror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+// Grow a class to hold at least one more task
+static void class_reserve(sched_class_t *class) {
+	if (class->count < class->capacity) return;
+	size_t capacity = class->capacity ? class->capacity * 2 : 256;
+	file_info_t *tasks = (file_info_t *)realloc(class->tasks, sizeof(file_info_t) * capacity);
+	if (tasks != NULL) class->tasks = tasks;
+	long long *sizes = (long long *)realloc(class->sizes, sizeof(long long) * capacity);
+	if (sizes != NULL) class->sizes = sizes;
+	if (tasks == NULL || sizes == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	class->capacity = capacity;
+}
+
+// Queue walker tasks by size; the caller already holds a directory reference for each
+void sched_add_batch(sched_t *sched, const file_info_t *tasks, const long long *sizes, int count) {
+	pthread_mutex_lock(&sched->mutex);
+	for (int i = 0; i < count; i++) {
+		sched_class_t *class = &sched->classes[class_of(sizes[i])];
+		class_reserve(class);
+		class->tasks[class->count] = tasks[i];
+		class->sizes[class->count] = sizes[i];
+		class->count++;
+	}
+	sched->pending += (size_t)count;
+	pthread_cond_signal(&sched->cond);
+	pthread_mutex_unlock(&sched->mutex);
+}
+
+// No more tasks will be added: wait until the dispatcher has handed all of them to the buffer
+void sched_finish(sched_t *sched) {
+	pthread_mutex_lock(&sched->mutex);
+	sched->closed = 1;
+	pthread_cond_signal(&sched->cond);
+	pthread_mutex_unlock(&sched->mutex);
+	pthread_join(sched->thread, NULL);
+}
+
+// Convert the simulated schedule to time, pricing a byte equivalent at the workers' measured
+// busy time per unit of cost. predicted is the most loaded simulated worker, bound the best any
+// schedule could do: an even split, or the largest task alone if that takes longer.
+void sched_estimate(const sched_t *sched, long long busy_ns, long long *predicted_ns, long long *bound_ns) {
+	long long max = 0;
+	for (int i = 0; i < sched->num_workers; i++) {
+		if (sched->loads[i] > max) max = sched->loads[i];
+	}
+	long long even = sched->total_cost / sched->num_workers;
+	double ns_per_cost = sched->total_cost > 0 ? (double)busy_ns / (double)sched->total_cost : 0.0;
+	*predicted_ns = (long long)(max * ns_per_cost);
+	*bound_ns = (long long)((even > sched->largest_cost ? even : sched->largest_cost) * ns_per_cost);
+}
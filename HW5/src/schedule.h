@@ -0,0 +1,56 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <pthread.h>
+#include "buffer.h"
+
+#define SCHEDULE_CLASSES 64            // Size class i holds tasks of [2^(i-1), 2^i) bytes, class 0 empty files
+#define SCHEDULE_SMALL (1LL << 20)     // Tasks below this size are dispatched in batches
+#define SCHEDULE_FILE_COST (64 << 10)  // Per-task overhead (open, create, close) in byte equivalents
+
+// Queuing order of copy tasks
+typedef enum {
+	SCHEDULE_FIFO,                 // Straight to the buffer in directory order
+	SCHEDULE_LARGEST               // Held in size classes, the largest known task goes out first
+} sched_mode_t;
+
+// Tasks of one size class
+typedef struct {
+	file_info_t *tasks;         // Stack of tasks
+	long long *sizes;           // Size of each task
+	size_t count;               // Queued tasks
+	size_t capacity;            // Allocated tasks
+} sched_class_t;
+
+// Largest-first scheduler. Walkers drop tasks into log2 size classes; a dispatcher thread
+// keeps the buffer full from the largest non-empty class, so big files start as soon as they
+// are found instead of behind everything read before them. Small tasks leave in batches.
+// The dispatch order is replayed as list scheduling on num_workers simulated workers to
+// predict the makespan.
+typedef struct sched {
+	buffer_t *buffer;           // Buffer feeding the workers
+	int batch_size;             // Small tasks per dispatch
+	int num_workers;            // Simulated workers
+	sched_class_t classes[SCHEDULE_CLASSES];   // Pending tasks by size
+	size_t pending;             // Tasks in all classes
+	int closed;                 // The walk is over, no more tasks will arrive
+	pthread_mutex_t mutex;      // Protects classes, pending and closed
+	pthread_cond_t cond;        // Signaled when tasks arrive or the walk ends
+	pthread_t thread;           // Dispatcher
+	long long *loads;           // Simulated load of each worker, in byte equivalents
+	long long total_cost;       // Sum of all dispatched task costs
+	long long largest_cost;     // Most expensive single task
+	long long tasks;            // Dispatched tasks
+	long long first_ns;         // When the first task was dispatched
+	long long end_ns;           // When the workers finished, set by the caller for the report
+} sched_t;
+
+int parse_sched_mode(const char *name, sched_mode_t *mode);
+int sched_init(sched_t *sched, buffer_t *buffer, int batch_size, int num_workers);
+void sched_destroy(sched_t *sched);
+int sched_start(sched_t *sched);
+void sched_add_batch(sched_t *sched, const file_info_t *tasks, const long long *sizes, int count);
+void sched_finish(sched_t *sched);
+void sched_estimate(const sched_t *sched, long long busy_ns, long long *predicted_ns, long long *bound_ns);
+
+#endif //SCHEDULE_H
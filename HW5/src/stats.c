@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include "stats.h"
+#include "copier.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/sysmacros.h>
+
+// Monotonic clock in nanoseconds
+long long stats_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Add one latency to the log2 histogram
+void stats_record_latency(worker_stats_t *stats, long long latency_ns) {
+	long long us = latency_ns / 1000;
+	int bucket = 0;
+	while (us > 1 && bucket < STATS_LATENCY_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	stats->latency[bucket]++;
+	atomic_fetch_add_explicit(&stats->latency_ns, latency_ns, memory_order_relaxed);
+}
+
+// Fold every worker shard into total
+void stats_sum(const worker_stats_t *shards, int count, worker_stats_t *total) {
+	memset(total, 0, sizeof(*total));
+	for (int i = 0; i < count; i++) {
+		const worker_stats_t *s = &shards[i];
+		total->files += atomic_load_explicit(&s->files, memory_order_relaxed);
+		total->bytes += atomic_load_explicit(&s->bytes, memory_order_relaxed);
+		total->latency_ns += atomic_load_explicit(&s->latency_ns, memory_order_relaxed);
+		total->skipped_files += s->skipped_files;
+		total->skipped_bytes += s->skipped_bytes;
+		total->hole_bytes += s->hole_bytes;
+		total->dedup_files += s->dedup_files;
+		total->dedup_bytes += s->dedup_bytes;
+		for (int m = 0; m < COPY_METHOD_COUNT; m++) {
+			total->method_files[m] += s->method_files[m];
+			total->method_bytes[m] += s->method_bytes[m];
+		}
+		total->busy_ns += s->busy_ns;
+		total->idle_ns += s->idle_ns;
+		for (int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+			total->latency[b] += s->latency[b];
+		}
+	}
+}
+
+static void *sampler_thread(void *arg) {
+	depth_sampler_t *sampler = (depth_sampler_t *)arg;
+	long long start = stats_now_ns();
+	struct timespec interval = {.tv_sec = 0, .tv_nsec = STATS_SAMPLE_MS * 1000000L};
+	while (!atomic_load(&sampler->stop)) {
+		if (sampler->count == sampler->capacity) {
+			size_t capacity = sampler->capacity ? sampler->capacity * 2 : 1024;
+			depth_sample_t *samples = (depth_sample_t *)realloc(sampler->samples, sizeof(depth_sample_t) * capacity);
+			if (samples == NULL) break;     // Keep what was recorded so far
+			sampler->samples = samples;
+			sampler->capacity = capacity;
+		}
+		depth_sample_t *sample = &sampler->samples[sampler->count++];
+		sample->t_us = (stats_now_ns() - start) / 1000;
+		sample->depth = buffer_count(sampler->buffer);
+		nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+// Start sampling the queue depth
+int depth_sampler_start(depth_sampler_t *sampler, buffer_t *buffer) {
+	memset(sampler, 0, sizeof(*sampler));
+	sampler->buffer = buffer;
+	return pthread_create(&sampler->thread, NULL, sampler_thread, sampler) == 0 ? 0 : -1;
+}
+
+// Stop sampling; the samples stay available until the sampler is discarded
+void depth_sampler_stop(depth_sampler_t *sampler) {
+	atomic_store(&sampler->stop, 1);
+	pthread_join(sampler->thread, NULL);
+}
+
+static void write_histogram(FILE *out, const long long *latency) {
+	fprintf(out, "[");
+	for (int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+		fprintf(out, "%s%lld", b ? ", " : "", latency[b]);
+	}
+	fprintf(out, "]");
+}
+
+// Write the run's statistics as JSON; latency buckets are log2 microseconds
+int stats_write_json(const char *path, const struct thread_params *params, long long elapsed_us, const depth_sampler_t *sampler) {
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		perror(path);
+		return -1;
+	}
+	worker_stats_t total;
+	stats_sum(params->worker_stats, params->num_workers, &total);
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"workers\": %d,\n", params->num_workers);
+	fprintf(out, "  \"buffer_size\": %d,\n", params->buffer_size);
+	fprintf(out, "  \"elapsed_us\": %lld,\n", elapsed_us);
+	fprintf(out, "  \"regular_files\": %d,\n", atomic_load(&params->regular_files));
+	fprintf(out, "  \"fifo_files\": %d,\n", atomic_load(&params->fifo_files));
+	fprintf(out, "  \"directories\": %d,\n", atomic_load(&params->directories));
+	fprintf(out, "  \"hardlinks\": %d,\n", atomic_load(&params->hardlinks));
+	fprintf(out, "  \"symlinks\": %d,\n", atomic_load(&params->symlinks));
+	fprintf(out, "  \"files\": %lld,\n", total.files);
+	fprintf(out, "  \"bytes\": %lld,\n", total.bytes);
+	fprintf(out, "  \"skipped_files\": %lld,\n", total.skipped_files + atomic_load(&params->skipped_files));
+	fprintf(out, "  \"skipped_bytes\": %lld,\n", total.skipped_bytes + atomic_load(&params->skipped_bytes));
+	fprintf(out, "  \"hole_bytes\": %lld,\n", total.hole_bytes);
+	fprintf(out, "  \"dedup_files\": %lld,\n", total.dedup_files);
+	fprintf(out, "  \"dedup_bytes\": %lld,\n", total.dedup_bytes);
+	if (params->meta != NULL) {
+		fprintf(out, "  \"metadata_applied\": %lld,\n", (long long)atomic_load(&params->meta->applied));
+		fprintf(out, "  \"metadata_failed\": %lld,\n", (long long)atomic_load(&params->meta->failed));
+	}
+	if (params->sched != NULL) {
+		long long predicted_ns, bound_ns;
+		sched_estimate(params->sched, total.busy_ns, &predicted_ns, &bound_ns);
+		fprintf(out, "  \"schedule\": {\"tasks\": %lld, \"predicted_us\": %lld, \"lower_bound_us\": %lld, \"actual_us\": %lld},\n",
+				params->sched->tasks, predicted_ns / 1000, bound_ns / 1000,
+				params->sched->first_ns > 0 ? (params->sched->end_ns - params->sched->first_ns) / 1000 : 0);
+	}
+	if (params->plan != NULL) {
+		plan_write_json(params->plan, out);
+	}
+	if (params->verify != NULL) {
+		verify_write_json(params->verify, out);
+	}
+	if (params->fanout != NULL) {
+		fanout_write_json(params->fanout, out);
+	}
+	if (params->devices != NULL) {
+		fprintf(out, "  \"devices\": [");
+		for (int i = 0; i < params->devices->num_queues; i++) {
+			device_queue_t *queue = &params->devices->queues[i];
+			fprintf(out, "%s\n    {\"src\": \"%u:%u\", \"dst\": \"%u:%u\", \"tasks\": %lld, \"bytes\": %lld, \"peak_inflight\": %d, \"throttled\": %lld}",
+					i ? "," : "", major(queue->src_dev), minor(queue->src_dev), major(queue->dst_dev), minor(queue->dst_dev),
+					queue->dispatched, queue->bytes, queue->peak, queue->throttled);
+		}
+		fprintf(out, "\n  ],\n");
+	}
+	fprintf(out, "  \"methods\": {");
+	for (int m = 0; m < COPY_METHOD_COUNT; m++) {
+		fprintf(out, "%s\n    \"%s\": {\"files\": %lld, \"bytes\": %lld}", m ? "," : "",
+				copy_method_name(m), total.method_files[m], total.method_bytes[m]);
+	}
+	fprintf(out, "\n  },\n");
+	fprintf(out, "  \"latency_bucket_us\": [");
+	for (int b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+		fprintf(out, "%s%lld", b ? ", " : "", 1LL << b);
+	}
+	fprintf(out, "],\n");
+	fprintf(out, "  \"latency\": ");
+	write_histogram(out, total.latency);
+	fprintf(out, ",\n");
+	fprintf(out, "  \"per_worker\": [");
+	for (int i = 0; i < params->num_workers; i++) {
+		const worker_stats_t *s = &params->worker_stats[i];
+		fprintf(out, "%s\n    {\"id\": %d, \"files\": %lld, \"bytes\": %lld, \"skipped_files\": %lld, \"busy_us\": %lld, \"idle_us\": %lld, \"latency\": ",
+				i ? "," : "", i, s->files, s->bytes, s->skipped_files, s->busy_ns / 1000, s->idle_ns / 1000);
+		write_histogram(out, s->latency);
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n  ],\n");
+	fprintf(out, "  \"queue_depth\": {\"interval_ms\": %d, \"samples\": [", STATS_SAMPLE_MS);
+	for (size_t i = 0; sampler != NULL && i < sampler->count; i++) {
+		fprintf(out, "%s[%lld, %d]", i ? ", " : "", sampler->samples[i].t_us, sampler->samples[i].depth);
+	}
+	fprintf(out, "]}\n");
+	fprintf(out, "}\n");
+	return fclose(out) == 0 ? 0 : -1;
+}
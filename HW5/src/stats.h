@@ -0,0 +1,60 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "buffer.h"
+#include "copy_engine.h"
+
+#define STATS_LATENCY_BUCKETS 32    // Bucket i counts latencies in [2^i, 2^(i+1)) microseconds
+#define STATS_SAMPLE_MS 10          // Queue depth sampling interval
+
+struct thread_params;
+
+// Counters owned by one worker thread. Each worker writes only its own shard, so the hot
+// path needs no shared atomics; shards are summed after the workers are joined. files, bytes,
+// latency_ns and the done counters are relaxed atomics because the auto pool tuner and the
+// progress reporter read them mid-run.
+typedef struct {
+	atomic_llong files;         // Files finished by this worker
+	atomic_llong bytes;         // Bytes written by this worker
+	atomic_llong latency_ns;    // Sum of all recorded latencies
+	atomic_llong done_files;    // Files finished in any way (copied, unchanged, failed), for progress
+	atomic_llong done_bytes;    // Bytes of finished tasks whether written, compared, skipped as holes or linked
+	long long skipped_files;    // Files found identical
+	long long skipped_bytes;    // Bytes found identical
+	long long hole_bytes;       // Sparse-file holes left unwritten
+	long long dedup_files;      // Duplicates linked or cloned instead of copied
+	long long dedup_bytes;      // Bytes those duplicates did not write
+	long long method_files[COPY_METHOD_COUNT];  // Files finished by each backend
+	long long method_bytes[COPY_METHOD_COUNT];  // Bytes moved by each backend
+	long long busy_ns;          // Time spent copying
+	long long idle_ns;          // Time spent waiting for tasks
+	long long latency[STATS_LATENCY_BUCKETS];   // Per-file copy latency histogram
+} __attribute__((aligned(64))) worker_stats_t;
+
+// One queue depth observation
+typedef struct {
+	long long t_us;             // Microseconds since the sampler started
+	int depth;                  // Tasks in the buffer
+} depth_sample_t;
+
+// Background thread recording buffer_count() every STATS_SAMPLE_MS
+typedef struct {
+	pthread_t thread;           // Sampling thread
+	buffer_t *buffer;           // Buffer being observed
+	atomic_int stop;            // Set to end sampling
+	depth_sample_t *samples;    // Recorded samples
+	size_t count;               // Number of samples
+	size_t capacity;            // Allocated samples
+} depth_sampler_t;
+
+long long stats_now_ns(void);
+void stats_record_latency(worker_stats_t *stats, long long latency_ns);
+void stats_sum(const worker_stats_t *shards, int count, worker_stats_t *total);
+int depth_sampler_start(depth_sampler_t *sampler, buffer_t *buffer);
+void depth_sampler_stop(depth_sampler_t *sampler);
+int stats_write_json(const char *path, const struct thread_params *params, long long elapsed_us, const depth_sampler_t *sampler);
+
+#endif //STATS_H
@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+#include "sync.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+
+// Size and modification time match, so the destination is assumed to be up to date
+int sync_unchanged(const struct stat *src_stat, const struct stat *dst_stat) {
+	return S_ISREG(dst_stat->st_mode) && dst_stat->st_size == src_stat->st_size &&
+			dst_stat->st_mtim.tv_sec == src_stat->st_mtim.tv_sec &&
+			dst_stat->st_mtim.tv_nsec == src_stat->st_mtim.tv_nsec;
+}
+
+// Give the destination the source's access and modification times, so the next sync run
+// recognises it as unchanged
+void sync_copy_times(const char *src, const char *dst) {
+	struct stat statbuf;
+	if (stat(src, &statbuf) == -1) {
+		perror("stat");
+		return;
+	}
+	struct timespec times[2] = {statbuf.st_atim, statbuf.st_mtim};
+	if (utimensat(AT_FDCWD, dst, times, 0) == -1) {
+		perror("utimensat");
+	}
+}
+
+// Remove name below dirfd, recursing into directories
+static int remove_tree(int dirfd, const char *name) {
+	if (unlinkat(dirfd, name, 0) == 0) {
+		return 0;
+	}
+	if (errno != EISDIR && errno != EPERM) {
+		return -1;
+	}
+	int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (fd == -1) {
+		return -1;
+	}
+	DIR *dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+		return -1;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		if (remove_tree(fd, entry->d_name) == -1) {
+			perror(entry->d_name);
+		}
+	}
+	closedir(dir);
+	return unlinkat(dirfd, name, AT_REMOVEDIR);
+}
+
+// Delete every destination entry that no longer exists in the source directory
+void sync_delete_extraneous(int src_dirfd, int dst_dirfd, const char *dst_dir, thread_params_t *params) {
+	int fd = dup(dst_dirfd);    // fdopendir() takes ownership and moves the offset
+	if (fd == -1) {
+		perror("dup");
+		return;
+	}
+	DIR *dir = fdopendir(fd);
+	if (dir == NULL) {
+		perror("fdopendir");
+		close(fd);
+		return;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		struct stat statbuf;
+		if (fstatat(src_dirfd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0 || errno != ENOENT) {
+			continue;   // Still in the source (or cannot tell), keep it
+		}
+		if (remove_tree(dst_dirfd, entry->d_name) == -1) {
+			perror("remove");
+			continue;
+		}
+		atomic_fetch_add(&params->deleted_entries, 1);
+		if (params->verbose) {
+			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
+			printf("Deleted extraneous: %s/%s\n", dst_dir, entry->d_name);
+			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
+		}
+	}
+	closedir(dir);
+}
@@ -0,0 +1,11 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <sys/stat.h>
+#include "copier.h"
+
+int sync_unchanged(const struct stat *src_stat, const struct stat *dst_stat);
+void sync_copy_times(const char *src, const char *dst);
+void sync_delete_extraneous(int src_dirfd, int dst_dirfd, const char *dst_dir, thread_params_t *params);
+
+#endif //SYNC_H
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include "tar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+// Store value as NUL-terminated octal, or in GNU base-256 when it needs more digits
+static void put_number(char *field, size_t width, unsigned long long value) {
+	if (value < (1ULL << (3 * (width - 1)))) {
+		snprintf(field, width, "%0*llo", (int)(width - 1), value);
+		return;
+	}
+	memset(field, 0, width);
+	field[0] = (char)0x80;
+	for (size_t i = width - 1; i > 0 && value > 0; i--) {
+		field[i] = (char)(value & 0xff);
+		value >>= 8;
+	}
+}
+
+// Fill one ustar header block; name and link are cut at 100 bytes, long ones get GNU records first
+static void fill_header(char *block, const char *name, const struct stat *st, char type, long long size, const char *link) {
+	memset(block, 0, TAR_BLOCK);
+	size_t len = strlen(name);
+	memcpy(block, name, len < 100 ? len : 100);
+	put_number(block + 100, 8, st->st_mode & 07777);
+	put_number(block + 108, 8, st->st_uid);
+	put_number(block + 116, 8, st->st_gid);
+	put_number(block + 124, 12, (unsigned long long)size);
+	put_number(block + 136, 12, st->st_mtim.tv_sec > 0 ? (unsigned long long)st->st_mtim.tv_sec : 0);
+	block[156] = type;
+	if (link != NULL) {
+		len = strlen(link);
+		memcpy(block + 157, link, len < 100 ? len : 100);
+	}
+	memcpy(block + 257, "ustar", 6);
+	memcpy(block + 263, "00", 2);
+	put_number(block + 329, 8, 0);
+	put_number(block + 337, 8, 0);
+	memset(block + 148, ' ', 8);    // The checksum counts its own field as spaces
+	unsigned sum = 0;
+	for (int i = 0; i < TAR_BLOCK; i++) {
+		sum += (unsigned char)block[i];
+	}
+	snprintf(block + 148, 7, "%06o", sum);
+	block[155] = ' ';
+}
+
+// GNU long name ('L') or long link ('K') record carrying a value too long for its field
+static size_t long_record(char *out, char type, const char *value, const struct stat *st) {
+	size_t len = strlen(value);
+	if (len <= 100) return 0;
+	size_t padded = (len + TAR_BLOCK) / TAR_BLOCK * TAR_BLOCK;  // Room for the NUL
+	fill_header(out, "././@LongLink", st, type, (long long)len + 1, NULL);
+	memset(out + TAR_BLOCK, 0, padded);
+	memcpy(out + TAR_BLOCK, value, len);
+	return TAR_BLOCK + padded;
+}
+
+// All header blocks of one entry; returns the bytes written to out
+static size_t build_headers(char *out, const char *name, const struct stat *st, char type, long long size, const char *link) {
+	size_t used = long_record(out, 'L', name, st);
+	if (link != NULL) {
+		used += long_record(out + used, 'K', link, st);
+	}
+	fill_header(out + used, name, st, type, size, link);
+	return used + TAR_BLOCK;
+}
+
+// Name of src inside the archive, relative to the source root like tar -C src .
+static void archive_name(const tar_t *tar, const char *src, int dir, char *name, size_t size) {
+	const char *rel = src + tar->root_len;
+	while (*rel == '/') rel++;
+	snprintf(name, size, "./%s%s", rel, dir && *rel != '\0' ? "/" : "");
+}
+
+// Hand out count consecutive sequence numbers
+static long long take_seq(tar_t *tar, long long count) {
+	pthread_mutex_lock(&tar->mutex);
+	long long seq = tar->next_seq;
+	tar->next_seq += count;
+	pthread_mutex_unlock(&tar->mutex);
+	return seq;
+}
+
+// Wait until seq fits in the window; the slot is then the caller's until it commits
+static tar_slot_t *claim_slot(tar_t *tar, long long seq) {
+	pthread_mutex_lock(&tar->mutex);
+	while (seq >= tar->written + tar->window) {
+		pthread_cond_wait(&tar->drained, &tar->mutex);
+	}
+	pthread_mutex_unlock(&tar->mutex);
+	return &tar->slots[seq % tar->window];
+}
+
+// The slot holds length bytes for the writer
+static void commit_slot(tar_t *tar, tar_slot_t *slot, size_t length) {
+	pthread_mutex_lock(&tar->mutex);
+	slot->length = length;
+	slot->ready = 1;
+	pthread_cond_signal(&tar->filled);
+	pthread_mutex_unlock(&tar->mutex);
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t n = write(fd, data, length);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) return -1;
+		data += n;
+		length -= (size_t)n;
+	}
+	return 0;
+}
+
+// Ordered writer: streams the slots out by sequence number. After a write error the slots are
+// still drained so producers never wait for a writer that gave up.
+static void *writer_thread(void *arg) {
+	tar_t *tar = (tar_t *)arg;
+	pthread_mutex_lock(&tar->mutex);
+	for (;;) {
+		tar_slot_t *slot = &tar->slots[tar->written % tar->window];
+		while (!slot->ready && !(tar->closed && tar->written == tar->next_seq)) {
+			pthread_cond_wait(&tar->filled, &tar->mutex);
+		}
+		if (!slot->ready) break;    // Closed and everything written
+		int error = tar->error;
+		pthread_mutex_unlock(&tar->mutex);
+		if (!error && write_all(tar->fd, slot->data, slot->length) == -1) {
+			perror("write archive");
+			error = 1;
+		} else if (!error) {
+			atomic_fetch_add_explicit(&tar->bytes, (long long)slot->length, memory_order_relaxed);
+		}
+		pthread_mutex_lock(&tar->mutex);
+		tar->error = error;
+		slot->ready = 0;
+		tar->written++;
+		pthread_cond_broadcast(&tar->drained);
+	}
+	pthread_mutex_unlock(&tar->mutex);
+	return NULL;
+}
+
+int tar_start(tar_t *tar, int fd, const char *src_root, int num_workers) {
+	memset(tar, 0, sizeof(*tar));
+	tar->fd = fd;
+	tar->root_len = strlen(src_root);
+	struct stat st;
+	if (fstat(fd, &st) == 0) {
+		tar->dev = st.st_dev;
+		tar->ino = st.st_ino;
+	}
+	tar->window = (long long)num_workers * TAR_WINDOW_PER_WORKER;
+	tar->slots = (tar_slot_t *)calloc((size_t)tar->window, sizeof(tar_slot_t));
+	if (tar->slots == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for (long long i = 0; i < tar->window; i++) {
+		if ((tar->slots[i].data = (char *)malloc(TAR_HEADER_ROOM + TAR_PIECE)) == NULL) {
+			perror("malloc");
+			return -1;
+		}
+	}
+	atomic_init(&tar->bytes, 0);
+	pthread_mutex_init(&tar->mutex, NULL);
+	pthread_cond_init(&tar->filled, NULL);
+	pthread_cond_init(&tar->drained, NULL);
+	if (pthread_create(&tar->thread, NULL, writer_thread, tar) != 0) {
+		perror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+// Archive a directory, symlink or FIFO found by a walker; it has no data so one slot holds it
+int tar_add_entry(tar_t *tar, const char *src, const struct stat *st) {
+	char name[MAX_PATH + 4], link[MAX_PATH];
+	char type;
+	if (S_ISDIR(st->st_mode)) {
+		type = '5';
+	} else if (S_ISFIFO(st->st_mode)) {
+		type = '6';
+	} else if (S_ISLNK(st->st_mode)) {
+		ssize_t len = readlink(src, link, sizeof(link) - 1);
+		if (len == -1) return -1;
+		link[len] = '\0';
+		type = '2';
+	} else {
+		errno = EINVAL;     // Sockets and devices are not archived
+		return -1;
+	}
+	archive_name(tar, src, S_ISDIR(st->st_mode), name, sizeof(name));
+	long long seq = take_seq(tar, 1);
+	tar_slot_t *slot = claim_slot(tar, seq);
+	commit_slot(tar, slot, build_headers(slot->data, name, st, type, 0, type == '2' ? link : NULL));
+	return 0;
+}
+
+// Archive a directory whose subtree is complete, called as its last reference goes away
+void tar_add_dir(tar_t *tar, const char *src) {
+	struct stat st;
+	if (lstat(src, &st) == -1 || tar_add_entry(tar, src, &st) == -1) {
+		perror("archive directory");
+	}
+}
+
+// Read a regular file into the archive, TAR_PIECE bytes per slot. The header carries the size
+// seen at open; a file that shrinks meanwhile is padded with zeros and reported as failed,
+// one that grows is cut at that size.
+int tar_add_file(tar_t *tar, const char *src, copy_result_t *result) {
+	int fd = open(src, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		perror("open src");
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+	result->method = COPY_METHOD_TAR;
+	result->bytes = 0;
+	if (st.st_dev == tar->dev && st.st_ino == tar->ino) {
+		fprintf(stderr, "%s is the archive, not added\n", src);
+		close(fd);
+		return 0;
+	}
+	char name[MAX_PATH + 4];
+	archive_name(tar, src, 0, name, sizeof(name));
+	long long size = st.st_size;
+	long long pieces = size > 0 ? (size + TAR_PIECE - 1) / TAR_PIECE : 1;
+	long long seq = take_seq(tar, pieces);
+	int status = 0;
+	long long offset = 0;
+	for (long long p = 0; p < pieces; p++) {
+		tar_slot_t *slot = claim_slot(tar, seq + p);
+		size_t used = p == 0 ? build_headers(slot->data, name, &st, '0', size, NULL) : 0;
+		size_t want = size - offset < TAR_PIECE ? (size_t)(size - offset) : TAR_PIECE;
+		size_t got = 0;
+		while (status == 0 && got < want) {
+			ssize_t n = read(fd, slot->data + used + got, want - got);
+			if (n == -1 && errno == EINTR) continue;
+			if (n <= 0) {
+				fprintf(stderr, "%s: %s while archiving\n", src, n == 0 ? "file shrank" : strerror(errno));
+				status = -1;
+				break;
+			}
+			got += (size_t)n;
+		}
+		result->bytes += (long long)got;
+		size_t padded = p == pieces - 1 ? (want + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK : want;
+		memset(slot->data + used + got, 0, padded - got);  // Zeros for a shrunk file and the last block
+		commit_slot(tar, slot, used + padded);
+		offset += (long long)want;
+	}
+	close(fd);
+	return status;
+}
+
+// No more entries: wait for the writer, end the archive with two zero blocks padded to a full
+// record, and release the window. The caller closes the descriptor.
+int tar_finish(tar_t *tar) {
+	pthread_mutex_lock(&tar->mutex);
+	tar->closed = 1;
+	pthread_cond_signal(&tar->filled);
+	pthread_mutex_unlock(&tar->mutex);
+	pthread_join(tar->thread, NULL);
+	long long bytes = atomic_load(&tar->bytes);
+	size_t end = 2 * TAR_BLOCK;
+	end += (TAR_RECORD - (bytes + end) % TAR_RECORD) % TAR_RECORD;
+	char *zeros = (char *)calloc(1, end);
+	if (zeros == NULL || (!tar->error && write_all(tar->fd, zeros, end) == -1)) {
+		perror("write archive");
+		tar->error = 1;
+	} else if (!tar->error) {
+		atomic_fetch_add(&tar->bytes, (long long)end);
+	}
+	free(zeros);
+	for (long long i = 0; i < tar->window; i++) {
+		free(tar->slots[i].data);
+	}
+	free(tar->slots);
+	pthread_mutex_destroy(&tar->mutex);
+	pthread_cond_destroy(&tar->filled);
+	pthread_cond_destroy(&tar->drained);
+	return tar->error ? -1 : 0;
+}
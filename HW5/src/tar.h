@@ -0,0 +1,55 @@
+#ifndef TAR_H
+#define TAR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "copy_engine.h"
+#include "task.h"
+
+#define TAR_BLOCK 512               // Archive block; headers and data are padded to it
+#define TAR_RECORD (20 * TAR_BLOCK) // The archive ends on a full record, like tar's default blocking
+#define TAR_PIECE (256 << 10)       // File bytes per reorder slot, a multiple of TAR_BLOCK
+#define TAR_HEADER_ROOM (6 * TAR_BLOCK + 2 * MAX_PATH)  // Header plus GNU long name and long link records
+#define TAR_WINDOW_PER_WORKER 4     // Reorder slots per worker
+
+// One position of the reorder window: the bytes of one archive sequence number
+typedef struct {
+	char *data;                 // Headers and/or file data, TAR_HEADER_ROOM + TAR_PIECE bytes
+	size_t length;              // Bytes to write
+	int ready;                  // Filled by its producer, waiting for the writer
+} tar_slot_t;
+
+// Tar archive sink. Every header and every TAR_PIECE of file data gets a sequence number;
+// walkers and workers fill the slot of their number in any order and a single writer thread
+// streams the slots out in sequence. Producers wait while their number is more than the
+// window ahead of the writer, so memory stays at window * TAR_PIECE however large the tree.
+// A worker takes the numbers of a file only when it starts reading it, so the lowest pending
+// number always belongs to a thread that is filling it and the window cannot deadlock.
+// Directories are archived after their contents, so extractors that finalise a directory
+// once they leave it (GNU tar) still restore its times although the walk is not depth first.
+typedef struct tar {
+	int fd;                     // Archive file or standard output
+	size_t root_len;            // Length of the source root, stripped from archived names
+	dev_t dev;                  // The archive itself, never archived when it lies inside the source
+	ino_t ino;
+	tar_slot_t *slots;          // Reorder window
+	long long window;           // Number of slots
+	long long next_seq;         // Next sequence number to hand out
+	long long written;          // Sequence numbers already streamed out
+	int closed;                 // No more entries, the writer ends the archive once it catches up
+	int error;                  // Writing the archive failed
+	pthread_mutex_t mutex;      // Protects the sequence numbers and slots
+	pthread_cond_t filled;      // Signaled when a slot becomes ready or the archive is closed
+	pthread_cond_t drained;     // Signaled when the writer frees a slot
+	pthread_t thread;           // Ordered writer
+	atomic_llong bytes;         // Archive bytes written
+} tar_t;
+
+int tar_start(tar_t *tar, int fd, const char *src_root, int num_workers);
+int tar_add_entry(tar_t *tar, const char *src, const struct stat *st);
+void tar_add_dir(tar_t *tar, const char *src);
+int tar_add_file(tar_t *tar, const char *src, copy_result_t *result);
+int tar_finish(tar_t *tar);
+
+#endif //TAR_H
@@ -0,0 +1,105 @@
+#include "task.h"
+#include "journal.h"
+#include "meta.h"
+#include "tar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Create an interned directory holding one reference for the caller and one on its parent
+dir_ref_t *dir_ref_new(dir_ref_t *parent, const char *src, const char *dst) {
+	dir_ref_t *dir = (dir_ref_t *)malloc(sizeof(dir_ref_t));
+	if (dir == NULL || (dir->src = strdup(src)) == NULL || (dir->dst = strdup(dst)) == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	atomic_init(&dir->refs, 1);
+	atomic_init(&dir->incomplete, 0);
+	dir->parent = parent;
+	dir->journal = NULL;
+	dir->meta = NULL;
+	dir->tar = NULL;
+	dir->devices = NULL;
+	dir->device = 0;
+	if (parent != NULL) {
+		dir_ref_get(parent);
+		dir->journal = parent->journal;
+		dir->meta = parent->meta;
+		dir->tar = parent->tar;
+		dir->devices = parent->devices;
+	}
+	dir->names = NULL;
+	return dir;
+}
+
+// Copy a leaf name into the directory's arena; only the owning walker calls this
+const char *dir_ref_add_name(dir_ref_t *dir, const char *name) {
+	size_t len = strlen(name) + 1;
+	size_t capacity = NAME_BLOCK_SIZE - sizeof(name_block_t);
+	if (dir->names == NULL || dir->names->used + len > capacity) {
+		size_t block_size = len > capacity ? sizeof(name_block_t) + len : NAME_BLOCK_SIZE;
+		name_block_t *block = (name_block_t *)malloc(block_size);
+		if (block == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		block->next = dir->names;
+		block->used = 0;
+		dir->names = block;
+	}
+	char *copy = dir->names->data + dir->names->used;
+	memcpy(copy, name, len);
+	dir->names->used += len;
+	return copy;
+}
+
+void dir_ref_get(dir_ref_t *dir) {
+	atomic_fetch_add_explicit(&dir->refs, 1, memory_order_relaxed);
+}
+
+// Drop a reference; the last one means the subtree is finished. When preserving metadata the
+// directory goes to the finaliser, which calls dir_ref_finish() once its times and mode are set.
+void dir_ref_put(dir_ref_t *dir) {
+	while (dir != NULL && atomic_fetch_sub_explicit(&dir->refs, 1, memory_order_acq_rel) == 1) {
+		if (dir->meta != NULL) {
+			meta_add_dir(dir->meta, dir);
+			return;
+		}
+		dir = dir_ref_finish(dir);
+	}
+}
+
+// Retire a finished directory: it is archived after its contents, journaled (or its failure
+// passed up), the paths and the name arena are freed. Returns the parent, whose reference the
+// caller still has to drop.
+dir_ref_t *dir_ref_finish(dir_ref_t *dir) {
+	dir_ref_t *parent = dir->parent;
+	if (dir->tar != NULL) {
+		tar_add_dir(dir->tar, dir->src);
+	}
+	if (atomic_load(&dir->incomplete)) {
+		if (parent != NULL) atomic_store(&parent->incomplete, 1);
+	} else if (dir->journal != NULL) {
+		journal_dir_done(dir->journal, dir->src);
+	}
+	name_block_t *block = dir->names;
+	while (block != NULL) {
+		name_block_t *next = block->next;
+		free(block);
+		block = next;
+	}
+	free(dir->src);
+	free(dir->dst);
+	free(dir);
+	return parent;
+}
+
+// Build the full source path of a task
+void task_src_path(const file_info_t *task, char *path, size_t size) {
+	snprintf(path, size, "%s/%s", task->dir->src, task->name);
+}
+
+// Build the full destination path of a task
+void task_dst_path(const file_info_t *task, char *path, size_t size) {
+	snprintf(path, size, "%s/%s", task->dir->dst, task->name);
+}
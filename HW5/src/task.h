@@ -0,0 +1,65 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Maximum path length for file and directory names
+#define MAX_PATH 1024
+#define NAME_BLOCK_SIZE 4096    // Bytes per arena block holding leaf names
+#define HASH_TABLE_SIZE 4096    // Buckets of the chained hash tables (dedup, inode map)
+
+struct chunked_file;
+struct journal;
+struct meta;
+struct tar;
+struct devices;
+
+// Arena block of NUL-terminated leaf names
+typedef struct name_block {
+	struct name_block *next;    // Previously filled block
+	size_t used;                // Bytes used in data
+	char data[];                // Names
+} name_block_t;
+
+// Interned directory: every queued entry of one source directory shares this prefix.
+// Names are appended only by the walker reading the directory, before the tasks are queued.
+// Each directory also holds a reference on its parent, so the last reference to a directory
+// goes away only once its whole subtree is finished.
+typedef struct dir_ref {
+	atomic_int refs;            // Walker reference plus one per queued task and per subdirectory
+	atomic_int incomplete;      // Something in the subtree failed or was cut short
+	struct dir_ref *parent;     // Enclosing directory, NULL for the root
+	struct journal *journal;    // Records finished subtrees, NULL when not journaling
+	struct meta *meta;          // Finalises the directory after its subtree, NULL when not preserving
+	struct tar *tar;            // Archives the directory after its subtree, NULL for a directory copy
+	struct devices *devices;    // Per-device admission of its files, NULL when not throttling by device
+	int device;                 // Queue of its source and destination device pair in devices
+	char *src;                  // Source directory path
+	char *dst;                  // Destination directory path
+	name_block_t *names;        // Arena of leaf names, newest block first
+} dir_ref_t;
+
+#define TASK_COMPARE 0x1      // Destination exists with the same size: compare before writing
+#define TASK_DELTA 0x2        // Destination exists: rewrite only the blocks that differ
+
+// Structure to hold one queued copy task: directory prefix plus leaf name instead of two full paths
+typedef struct {
+	dir_ref_t *dir;             // Interned source and destination directories
+	const char *name;           // Leaf name, stored in dir's arena
+	struct chunked_file *chunked;   // Shared state when this is one chunk of a split file, else NULL
+	off_t offset;               // First byte of the chunk
+	off_t length;               // Bytes in the chunk
+	int flags;                  // TASK_* flags
+} file_info_t;
+
+dir_ref_t *dir_ref_new(dir_ref_t *parent, const char *src, const char *dst);
+const char *dir_ref_add_name(dir_ref_t *dir, const char *name);
+void dir_ref_get(dir_ref_t *dir);
+void dir_ref_put(dir_ref_t *dir);
+dir_ref_t *dir_ref_finish(dir_ref_t *dir);
+void task_src_path(const file_info_t *task, char *path, size_t size);
+void task_dst_path(const file_info_t *task, char *path, size_t size);
+
+#endif //TASK_H
@@ -0,0 +1,764 @@
+#define _GNU_SOURCE
+#include "traverse.h"
+#include "sync.h"
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+
+// Record layout returned by getdents64
+struct linux_dirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+// A directory still to be read
+typedef struct {
+	dir_ref_t *dir;             // Interned source and destination paths (destination already created)
+	int src_fd;                 // Source directory opened relative to its parent, -1 to open by path
+	int dst_fd;                 // Destination directory, opened together with src_fd
+} dir_task_t;
+
+// Per-walker double-ended queue: the owner pushes and pops at the tail (depth first),
+// thieves take from the head, where the oldest and usually largest subtrees sit
+typedef struct {
+	pthread_mutex_t mutex;      // Protects the deque, only contended while stealing
+	dir_task_t *tasks;          // Ring of tasks
+	size_t capacity;            // Allocated tasks
+	size_t head;                // Oldest task (steal side)
+	size_t count;               // Number of queued tasks
+} deque_t;
+
+// State shared by all walkers
+typedef struct {
+	thread_params_t *params;    // Shared thread parameters
+	walker_t *walkers;          // One per traversal thread
+	int num_walkers;            // Number of traversal threads
+	atomic_long pending;        // Directories queued or being read, the walk ends at 0
+	atomic_long queued;         // Directories sitting in some deque
+	atomic_int idle;            // Walkers parked on work_cond
+	atomic_int held_dirs;       // Queued directories holding open descriptors
+	pthread_mutex_t idle_mutex; // Protects parking
+	pthread_cond_t work_cond;   // Signaled when a task is pushed or the walk ends
+} walk_t;
+
+struct walker {
+	walk_t *walk;               // Shared walk state
+	int id;                     // Index in walk->walkers
+	unsigned seed;              // Victim selection
+	deque_t deque;              // This walker's tasks
+	file_info_t batch[TASK_BATCH_MAX];  // Copy tasks not yet handed to the buffer
+	long long batch_sizes[TASK_BATCH_MAX];  // Bytes each of them copies, for the scheduler
+	int batch_count;            // Number of tasks in batch
+	char *dents;                // getdents64 buffer
+	int regular_files;          // Counters folded into params when the walker exits
+	int fifo_files;
+	int directories;
+	int hardlinks;
+	int symlinks;
+	int skipped_files;
+	long long skipped_bytes;
+	int resumed_files;
+	int resumed_dirs;
+	long long found_files;      // Files and bytes queued since the last flush, for the progress ETA
+	long long found_bytes;
+	long long plan_files[PLAN_CLASSES];     // Plan mode size histogram, folded in when the walker exits
+	long long plan_bytes[PLAN_CLASSES];
+	long long plan_data;        // Allocated bytes of those files, what the copy moves
+	long long plan_largest;     // Largest file this walker offered to the plan
+	int plan_small;             // Small files seen, every PLAN_SAMPLE_STRIDE-th is offered as a sample
+	int mirror_fds[FANOUT_MAX]; // Fan-out: the directory being read in every further destination, -1 if missing
+};
+
+static void deque_init(deque_t *deque) {
+	pthread_mutex_init(&deque->mutex, NULL);
+	deque->tasks = NULL;
+	deque->capacity = 0;
+	deque->head = 0;
+	deque->count = 0;
+}
+
+static void deque_destroy(deque_t *deque) {
+	pthread_mutex_destroy(&deque->mutex);
+	free(deque->tasks);
+}
+
+// Push at the tail, growing the ring when needed
+static void deque_push(deque_t *deque, dir_task_t task) {
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->count == deque->capacity) {
+		size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+		dir_task_t *tasks = (dir_task_t *)malloc(sizeof(dir_task_t) * capacity);
+		if (tasks == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 0; i < deque->count; i++) {
+			tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+		}
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->capacity = capacity;
+		deque->head = 0;
+	}
+	deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+	deque->count++;
+	pthread_mutex_unlock(&deque->mutex);
+}
+
+// Pop from the tail (owner) or the head (thief)
+static int deque_pop(deque_t *deque, dir_task_t *task, int steal) {
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->count == 0) {
+		pthread_mutex_unlock(&deque->mutex);
+		return 0;
+	}
+	if (steal) {
+		*task = deque->tasks[deque->head];
+		deque->head = (deque->head + 1) % deque->capacity;
+	} else {
+		*task = deque->tasks[(deque->head + deque->count - 1) % deque->capacity];
+	}
+	deque->count--;
+	pthread_mutex_unlock(&deque->mutex);
+	return 1;
+}
+
+// Queue a subdirectory on the calling walker's deque and wake an idle walker.
+// The task owns src_fd and dst_fd; parent is NULL for the root.
+static void spawn_directory(walker_t *walker, dir_ref_t *parent, const char *src, const char *dst, int src_fd, int dst_fd) {
+	walk_t *walk = walker->walk;
+	dir_task_t task = {.dir = dir_ref_new(parent, src, dst), .src_fd = src_fd, .dst_fd = dst_fd};
+	if (parent == NULL) {
+		task.dir->journal = walk->params->journal;  // Children inherit these
+		task.dir->meta = walk->params->meta;
+		task.dir->tar = walk->params->tar;
+		task.dir->devices = walk->params->devices;
+	}
+	atomic_fetch_add(&walk->pending, 1);
+	deque_push(&walker->deque, task);
+	atomic_fetch_add(&walk->queued, 1);
+	if (atomic_load(&walk->idle) > 0) {
+		pthread_mutex_lock(&walk->idle_mutex);
+		pthread_cond_signal(&walk->work_cond);
+		pthread_mutex_unlock(&walk->idle_mutex);
+	}
+}
+
+// Own deque first, then try every other walker starting at a random victim
+static int find_task(walker_t *walker, dir_task_t *task) {
+	walk_t *walk = walker->walk;
+	if (deque_pop(&walker->deque, task, 0)) return 1;
+	int start = walk->num_walkers > 1 ? (int)(rand_r(&walker->seed) % (unsigned)walk->num_walkers) : 0;
+	for (int i = 0; i < walk->num_walkers; i++) {
+		walker_t *victim = &walk->walkers[(start + i) % walk->num_walkers];
+		if (victim != walker && deque_pop(&victim->deque, task, 1)) return 1;
+	}
+	return 0;
+}
+
+static void *walker_thread(void *arg) {
+	walker_t *walker = (walker_t *)arg;
+	walk_t *walk = walker->walk;
+	dir_task_t task;
+	for (;;) {
+		if (find_task(walker, &task)) {
+			atomic_fetch_sub(&walk->queued, 1);
+			if (task.src_fd != -1) {
+				atomic_fetch_sub(&walk->held_dirs, 1);
+			}
+			if (!termination_flag) {
+				traverse_directory(task.dir, task.src_fd, task.dst_fd, walker);
+			} else {
+				atomic_store(&task.dir->incomplete, 1);     // Never read, must not be journaled as done
+				if (task.src_fd != -1) {
+					close(task.src_fd);
+					if (task.dst_fd != -1) close(task.dst_fd);
+				}
+			}
+			dir_ref_put(task.dir);  // Drop the walker's reference, queued files keep theirs
+			if (atomic_fetch_sub(&walk->pending, 1) == 1) {  // Last directory of the tree
+				pthread_mutex_lock(&walk->idle_mutex);
+				pthread_cond_broadcast(&walk->work_cond);
+				pthread_mutex_unlock(&walk->idle_mutex);
+			}
+			continue;
+		}
+		pthread_mutex_lock(&walk->idle_mutex);
+		atomic_fetch_add(&walk->idle, 1);
+		while (atomic_load(&walk->queued) == 0 && atomic_load(&walk->pending) > 0) {
+			pthread_cond_wait(&walk->work_cond, &walk->idle_mutex);  // Park until something is pushed
+		}
+		atomic_fetch_sub(&walk->idle, 1);
+		pthread_mutex_unlock(&walk->idle_mutex);
+		if (atomic_load(&walk->pending) == 0) break;
+	}
+	thread_params_t *params = walk->params;
+	atomic_fetch_add(&params->regular_files, walker->regular_files);    // One add per walker instead of per entry
+	atomic_fetch_add(&params->fifo_files, walker->fifo_files);
+	atomic_fetch_add(&params->directories, walker->directories);
+	atomic_fetch_add(&params->hardlinks, walker->hardlinks);
+	atomic_fetch_add(&params->symlinks, walker->symlinks);
+	atomic_fetch_add(&params->skipped_files, walker->skipped_files);
+	atomic_fetch_add(&params->skipped_bytes, walker->skipped_bytes);
+	atomic_fetch_add(&params->resumed_files, walker->resumed_files);
+	atomic_fetch_add(&params->resumed_dirs, walker->resumed_dirs);
+	if (params->plan != NULL) {
+		plan_add(params->plan, walker->plan_files, walker->plan_bytes, walker->plan_data);
+	}
+	return NULL;
+}
+
+// Hand the walker's pending copy tasks to the buffer with one claim, or to the device queues
+// or the scheduler
+static void flush_tasks(walker_t *walker) {
+	thread_params_t *params = walker->walk->params;
+	if (walker->batch_count > 0) {
+		if (params->devices != NULL) {
+			devices_add_batch(params->devices, walker->batch, walker->batch_sizes, walker->batch_count);
+		} else if (params->sched != NULL) {
+			sched_add_batch(params->sched, walker->batch, walker->batch_sizes, walker->batch_count);
+		} else {
+			buffer_add_batch(params->buffer, walker->batch, walker->batch_count);
+		}
+		walker->batch_count = 0;
+	}
+	if (walker->found_files > 0) {  // Plan mode finds files without queuing them
+		atomic_fetch_add_explicit(&params->found_files, walker->found_files, memory_order_relaxed);
+		atomic_fetch_add_explicit(&params->found_bytes, walker->found_bytes, memory_order_relaxed);
+		walker->found_files = walker->found_bytes = 0;
+	}
+}
+
+// Queue a copy task of size bytes, taking a reference on its directory; tasks go to the buffer in batches
+static void queue_task(walker_t *walker, const file_info_t *file_info, long long size) {
+	dir_ref_get(file_info->dir);
+	walker->found_files += file_info->chunked == NULL;  // Split files are counted once by enqueue_chunks
+	walker->found_bytes += size;
+	walker->batch_sizes[walker->batch_count] = size;
+	walker->batch[walker->batch_count++] = *file_info;
+	if (walker->batch_count >= walker->walk->params->batch_size) {
+		flush_tasks(walker);
+	}
+}
+
+// Copies and plans have no archive; plans do not touch the destination either
+static int writes_destination(const thread_params_t *params) {
+	return params->tar == NULL && params->plan == NULL;
+}
+
+// A journal from an interrupted run is being consulted
+static int resuming(const thread_params_t *params) {
+	return params->journal != NULL && params->journal->loaded > 0;
+}
+
+// Fan-out: give a split file its size in every further destination as well, keeping the
+// finished chunks when resuming. A destination left unprepared fails its chunks there.
+static void size_mirrors(walker_t *walker, const char *name, const struct stat *st, int keep) {
+	fanout_t *fanout = walker->walk->params->fanout;
+	for (int i = 1; i < fanout->count; i++) {
+		int fd = openat(walker->mirror_fds[i], name, keep ? O_WRONLY | O_CLOEXEC : O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd == -1 || ((keep || copy_is_sparse(st) || fallocate(fd, 0, 0, st->st_size) == -1) && ftruncate(fd, st->st_size) == -1)) {
+			perror("open dst");
+		}
+		if (fd != -1) close(fd);
+	}
+}
+
+// Create the destination at its final size, then queue one task per chunk so several
+// workers copy the file concurrently. When resuming, chunks the journal lists as finished
+// are not queued again and the destination keeps their data. Returns -1 if the destination
+// cannot be prepared.
+static int enqueue_chunks(walker_t *walker, int dst_dirfd, file_info_t *file_info, const struct stat *st) {
+	thread_params_t *params = walker->walk->params;
+	off_t size = st->st_size;
+	off_t chunk = (off_t)params->chunk_size;
+	int chunks = (int)((size + chunk - 1) / chunk);
+	unsigned char *finished = NULL;     // Chunks the interrupted run completed
+	int resumed = 0;
+	if (resuming(params) && (finished = (unsigned char *)calloc((size_t)chunks, 1)) != NULL) {
+		for (int i = 0; i < chunks; i++) {
+			off_t offset = (off_t)i * chunk;
+			finished[i] = (unsigned char)journal_has_chunk(params->journal, file_info->dir->src, file_info->name,
+					offset, size - offset < chunk ? size - offset : chunk);
+			resumed += finished[i];
+		}
+		if (resumed == chunks) {    // Every chunk landed but the file record did not
+			if (params->meta != NULL) {
+				meta_add_file(params->meta, file_info->dir, file_info->name, META_JOURNAL);
+			} else {
+				journal_file_done(params->journal, file_info->dir->src, file_info->name);
+			}
+			walker->resumed_files++;
+			free(finished);
+			return 0;
+		}
+	}
+	if (resumed > 0 && !(file_info->flags & (TASK_DELTA | TASK_COMPARE))) {     // Keep the finished chunks
+		int dst_fd = openat(dst_dirfd, file_info->name, O_WRONLY | O_CLOEXEC);
+		if (dst_fd == -1 || ftruncate(dst_fd, size) == -1) {
+			perror("open dst");
+			if (dst_fd != -1) close(dst_fd);
+			free(finished);
+			return -1;
+		}
+		close(dst_fd);
+	} else if (file_info->flags & TASK_DELTA) {     // Delta chunks keep the existing blocks, only the size changes
+		int dst_fd = openat(dst_dirfd, file_info->name, O_WRONLY | O_CLOEXEC);
+		struct stat dst_stat;
+		if (dst_fd == -1 || fstat(dst_fd, &dst_stat) == -1 ||
+				(dst_stat.st_size != size && ftruncate(dst_fd, size) == -1)) {
+			perror("ftruncate");
+			if (dst_fd != -1) close(dst_fd);
+			free(finished);
+			return -1;
+		}
+		close(dst_fd);
+	} else if (!(file_info->flags & TASK_COMPARE)) {   // Compared chunks keep the existing, equally sized destination
+		int dst_fd = openat(dst_dirfd, file_info->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);   // Open destination file for writing
+		if (dst_fd == -1) {
+			perror("open dst");
+			free(finished);
+			return -1;
+		}
+		// Reserve the extents once; a sparse source only gets its size, chunks reserve their data extents
+		if ((copy_is_sparse(st) || fallocate(dst_fd, 0, 0, size) == -1) && ftruncate(dst_fd, size) == -1) {
+			perror("ftruncate");
+			close(dst_fd);
+			free(finished);
+			return -1;
+		}
+		close(dst_fd);
+	}
+
+	if (params->fanout != NULL) {
+		size_mirrors(walker, file_info->name, st, resumed > 0);
+	}
+	chunked_file_t *chunked = (chunked_file_t *)malloc(sizeof(chunked_file_t));
+	if (chunked == NULL) {
+		perror("malloc");
+		free(finished);
+		return -1;
+	}
+	atomic_init(&chunked->chunks_left, chunks - resumed);
+	atomic_init(&chunked->failed, 0);
+	atomic_init(&chunked->bytes, 0);
+	atomic_init(&chunked->skipped, 0);
+	atomic_init(&chunked->start_ns, 0);
+	atomic_init(&chunked->digest, 0);
+	atomic_init(&chunked->failed_dests, 0);
+	file_info->chunked = chunked;
+	walker->found_files++;
+	for (int i = 0; i < chunks; i++) {  // chunked may be freed by a worker after the last add
+		if (finished != NULL && finished[i]) continue;
+		file_info->offset = (off_t)i * chunk;
+		file_info->length = size - file_info->offset < chunk ? size - file_info->offset : chunk;
+		queue_task(walker, file_info, file_info->length);
+	}
+	free(finished);
+	return 0;
+}
+
+// Walk the whole source tree with params->num_walkers threads. Every subdirectory becomes a
+// task on the deque of the walker that found it; idle walkers steal from the others.
+// A subdirectory is created in the destination before its task is queued, so files are
+// only enqueued for copying once their parent directory exists.
+void traverse_tree(thread_params_t *params) {
+	walk_t walk = {.params = params, .num_walkers = params->num_walkers > 0 ? params->num_walkers : 1};
+	atomic_init(&walk.pending, 0);
+	atomic_init(&walk.queued, 0);
+	atomic_init(&walk.idle, 0);
+	atomic_init(&walk.held_dirs, 0);
+	pthread_mutex_init(&walk.idle_mutex, NULL);
+	pthread_cond_init(&walk.work_cond, NULL);
+	walk.walkers = (walker_t *)calloc((size_t)walk.num_walkers, sizeof(walker_t));
+	pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * (size_t)walk.num_walkers);
+	if (walk.walkers == NULL || threads == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < walk.num_walkers; i++) {
+		walk.walkers[i].walk = &walk;
+		walk.walkers[i].id = i;
+		walk.walkers[i].seed = (unsigned)i * 2654435761u + 1;
+		walk.walkers[i].dents = (char *)malloc(TRAVERSE_DENTS_SIZE);
+		if (walk.walkers[i].dents == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		deque_init(&walk.walkers[i].deque);
+	}
+
+	if (params->devices != NULL && devices_start(params->devices) == -1) {
+		params->devices = NULL;     // Fall back to the shared queue, before the root inherits it
+	}
+	if (resuming(params) && journal_has_dir(params->journal, params->src_dir)) {
+		atomic_fetch_add(&params->resumed_dirs, 1);     // The interrupted run had already finished
+	} else {
+		spawn_directory(&walk.walkers[0], NULL, params->src_dir, params->dst_dir, -1, -1);   // Seed with the root, opened by path
+	}
+	if (params->sched != NULL && sched_start(params->sched) == -1) {
+		params->sched = NULL;   // Fall back to queuing in directory order
+	}
+	for (int i = 1; i < walk.num_walkers; i++) {
+		pthread_create(&threads[i], NULL, walker_thread, &walk.walkers[i]);
+	}
+	walker_thread(&walk.walkers[0]);    // The calling thread is walker 0
+	for (int i = 1; i < walk.num_walkers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	if (params->devices != NULL) {
+		devices_finish(params->devices);    // Waiting tasks go out as the workers finish admitted ones
+	}
+	if (params->sched != NULL) {
+		sched_finish(params->sched);    // Everything is in the buffer before the manager marks it done
+	}
+
+	for (int i = 0; i < walk.num_walkers; i++) {
+		deque_destroy(&walk.walkers[i].deque);
+		free(walk.walkers[i].dents);
+	}
+	free(walk.walkers);
+	free(threads);
+	pthread_mutex_destroy(&walk.idle_mutex);
+	pthread_cond_destroy(&walk.work_cond);
+}
+
+// Open a subdirectory relative to the open parents so the walker that picks it up does not
+// resolve its path again. Queued directories hold two descriptors each, so only up to
+// TRAVERSE_HELD_DIRS are kept open; past that the child is reopened by path. When archiving
+// or planning there is no destination directory and dst_fd stays -1.
+static void open_child(walk_t *walk, int src_dirfd, int dst_dirfd, const char *name, int *src_fd, int *dst_fd) {
+	*src_fd = *dst_fd = -1;
+	if (atomic_load(&walk->held_dirs) >= TRAVERSE_HELD_DIRS) return;
+	*src_fd = openat(src_dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (writes_destination(walk->params)) {
+		*dst_fd = openat(dst_dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+	if (*src_fd == -1 || (*dst_fd == -1 && writes_destination(walk->params))) {
+		if (*src_fd != -1) close(*src_fd);
+		if (*dst_fd != -1) close(*dst_fd);
+		*src_fd = *dst_fd = -1;
+		return;
+	}
+	atomic_fetch_add(&walk->held_dirs, 1);
+}
+
+// Put a FIFO or symlink into the archive; st is NULL if it could not be stat'ed
+static void archive_special(walker_t *walker, dir_ref_t *dir_ref, const char *name, const struct stat *st) {
+	char src_path[MAX_PATH];
+	snprintf(src_path, sizeof(src_path), "%s/%s", dir_ref->src, name);
+	if (st == NULL || tar_add_entry(walker->walk->params->tar, src_path, st) == -1) {
+		perror("archive");
+		atomic_store(&dir_ref->incomplete, 1);
+	} else if (S_ISLNK(st->st_mode)) {
+		walker->symlinks++;
+	} else {
+		walker->fifo_files++;
+	}
+}
+
+// Plan mode: size one regular file with a statx asking for its size, blocks and links only,
+// add it to the walker's histogram and offer it as a calibration sample. A later name of a
+// hardlinked inode is only counted, the copy links it. st is set if the walker already had to
+// stat the entry.
+static void plan_file(walker_t *walker, dir_ref_t *dir_ref, int src_dirfd, const char *name, const struct stat *st) {
+	plan_t *plan = walker->walk->params->plan;
+	long long size, allocated;
+	if (st != NULL) {
+		size = st->st_size;
+		allocated = (long long)st->st_blocks * 512;
+		if (st->st_nlink > 1 && plan_link_seen(plan, st->st_dev, st->st_ino)) {
+			walker->hardlinks++;    // Reported like the copy's linked names
+			return;
+		}
+	} else {
+		struct statx stx;
+		if (statx(src_dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_SIZE | STATX_BLOCKS | STATX_NLINK | STATX_INO, &stx) == -1) {
+			perror("statx");
+			return;
+		}
+		size = (long long)stx.stx_size;
+		allocated = (long long)stx.stx_blocks * 512;
+		if (stx.stx_nlink > 1 && plan_link_seen(plan, makedev(stx.stx_dev_major, stx.stx_dev_minor), (ino_t)stx.stx_ino)) {
+			walker->hardlinks++;
+			return;
+		}
+	}
+	int class = plan_class(size);
+	walker->plan_files[class]++;
+	walker->plan_bytes[class] += size;
+	walker->plan_data += allocated < size ? allocated : size;  // Holes are skipped, not copied
+	walker->found_files++;
+	walker->found_bytes += size;
+	int dense = allocated >= size;  // Only a file without holes measures the streaming rate
+	if ((dense && size > walker->plan_largest) || (size > 0 && size < PLAN_SMALL && walker->plan_small++ % PLAN_SAMPLE_STRIDE == 0)) {
+		char path[MAX_PATH];
+		snprintf(path, sizeof(path), "%s/%s", dir_ref->src, name);
+		if (dense && size > walker->plan_largest) {
+			walker->plan_largest = size;
+			plan_offer_largest(plan, path, size);
+		} else {
+			plan_offer_sample(plan, path, size);
+		}
+	}
+}
+
+// Fan-out: repeat a new directory, FIFO or symlink in every further destination. One that
+// refuses it counts the failure without holding the others back.
+static void mirror_entry(walker_t *walker, int src_dirfd, const char *name, unsigned char type, mode_t mode) {
+	fanout_t *fanout = walker->walk->params->fanout;
+	for (int i = 1; i < fanout->count; i++) {
+		int fd = walker->mirror_fds[i];
+		int status;
+		if (type == DT_DIR) {
+			status = mkdirat(fd, name, 0755) == -1 && errno != EEXIST ? -1 : 0;
+		} else if (type == DT_FIFO) {
+			status = mkfifoat(fd, name, mode) == -1 && errno != EEXIST ? -1 : 0;
+		} else {
+			status = copy_symlink(src_dirfd, fd, name);
+		}
+		if (status == -1) {
+			fprintf(stderr, "Could not create %s in %s: %s\n", name, fanout->dests[i].root, strerror(errno));
+			fanout_fail(fanout, i);
+		}
+	}
+}
+
+// Handle one directory entry; paths are only formatted for output and for new subdirectories
+static void visit_entry(walker_t *walker, dir_ref_t *dir_ref, int src_dirfd, int dst_dirfd, const char *name, unsigned char type) {
+	thread_params_t *params = walker->walk->params;  // Shared thread parameters
+	struct stat statbuf, dst_statbuf;
+	int have_stat = 0;
+	if (type == DT_UNKNOWN) {   // Filesystem does not fill d_type, ask for the mode
+		if (fstatat(src_dirfd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+			perror("fstatat");
+			atomic_store(&dir_ref->incomplete, 1);
+			return;
+		}
+		have_stat = 1;
+		type = IFTODT(statbuf.st_mode);
+	}
+	if (type == DT_DIR) {    // If the entry is a directory
+		char src_path[MAX_PATH];    // Source path
+		char dst_path[MAX_PATH];    // Destination path
+		snprintf(src_path, sizeof(src_path), "%s/%s", dir_ref->src, name);   // Interned prefix for the child's tasks
+		if (resuming(params) && journal_has_dir(params->journal, src_path)) {
+			walker->resumed_dirs++;     // Whole subtree finished by the interrupted run, not walked again
+			return;
+		}
+		if (params->verbose) {
+			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
+			printf("Creating directory: %s/%s\n", dir_ref->dst, name);  // Print the directory creation message
+			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
+		}
+		// Archived directories get their header once their subtree is done
+		if (writes_destination(params) && mkdirat(dst_dirfd, name, 0755) == -1 && errno != EEXIST) {
+			perror("mkdirat");      // Reported once here instead of once per file below it
+			atomic_store(&dir_ref->incomplete, 1);
+			return;
+		}
+		if (params->fanout != NULL) {
+			mirror_entry(walker, src_dirfd, name, DT_DIR, 0755);
+		}
+		walker->directories++;    // Increment the directory count
+		snprintf(dst_path, sizeof(dst_path), "%s/%s", dir_ref->dst, name);
+		int src_fd, dst_fd;
+		open_child(walker->walk, src_dirfd, dst_dirfd, name, &src_fd, &dst_fd);
+		spawn_directory(walker, dir_ref, src_path, dst_path, src_fd, dst_fd);   // Queue the directory for any walker
+	} else if (type == DT_REG) {  // If the entry is a regular file
+		if (resuming(params) && journal_has_file(params->journal, dir_ref->src, name)) {
+			walker->resumed_files++;    // Copied by the interrupted run
+			return;
+		}
+		if (params->verbose) {
+			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
+			printf("Adding file to buffer: %s/%s\n", dir_ref->src, name);    // Print the file addition message
+			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
+		}
+		walker->regular_files++;    // Increment the regular file count
+		if (params->plan != NULL) {
+			plan_file(walker, dir_ref, src_dirfd, name, have_stat ? &statbuf : NULL);
+			return;
+		}
+		if (!have_stat && params->stat_files) {   // Size for splitting, sync and ordering, link count for hardlinks
+			have_stat = fstatat(src_dirfd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0;
+		}
+		if (have_stat && statbuf.st_nlink > 1 && params->inodes != NULL && inode_map_link(params->inodes, &statbuf, dst_dirfd, dir_ref->dst, name, walker->mirror_fds) == 1) {
+			walker->hardlinks++;    // Another name of an inode that is already copied or queued
+			return;
+		}
+		int compare = 0;    // TASK_COMPARE or TASK_DELTA: let a worker compare contents
+		if (have_stat && params->sync && fstatat(dst_dirfd, name, &dst_statbuf, AT_SYMLINK_NOFOLLOW) == 0) {
+			if (!params->checksum && sync_unchanged(&statbuf, &dst_statbuf)) {
+				walker->skipped_files++;
+				walker->skipped_bytes += statbuf.st_size;
+				if (params->meta != NULL) {     // Contents match, mode or owner may still have changed
+					meta_add_file(params->meta, dir_ref, dir_ref_add_name(dir_ref, name), 0);
+				}
+				return;
+			}
+			if (params->delta_block > 0 && S_ISREG(dst_statbuf.st_mode)) {
+				compare = TASK_DELTA;   // Any existing destination, blocks past its end are simply written
+			} else if (params->checksum && S_ISREG(dst_statbuf.st_mode) && dst_statbuf.st_size == statbuf.st_size) {
+				compare = TASK_COMPARE;
+			}
+		}
+		file_info_t file_info = {.dir = dir_ref, .name = dir_ref_add_name(dir_ref, name), .flags = compare};   // Initialize file information
+		if (have_stat && params->split_threshold > 0 && statbuf.st_size > params->split_threshold &&
+				enqueue_chunks(walker, dst_dirfd, &file_info, &statbuf) == 0) {
+			// Large file queued as chunks
+		} else {
+			queue_task(walker, &file_info, have_stat ? statbuf.st_size : 0);    // Add the file information to the buffer
+		}
+	} else if (type == DT_FIFO) { // If the entry is a FIFO file
+		if (params->verbose) {
+			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
+			printf("Creating FIFO: %s/%s\n", dir_ref->dst, name);    // Print the FIFO creation message
+			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
+		}
+		if (params->plan != NULL) {
+			walker->fifo_files++;
+			return;
+		}
+		if (!have_stat) {
+			have_stat = fstatat(src_dirfd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0;
+		}
+		if (params->tar != NULL) {
+			archive_special(walker, dir_ref, name, have_stat ? &statbuf : NULL);
+			return;
+		}
+		// Recreate the FIFO here: a worker opening it for reading would block until a writer shows up
+		if (mkfifoat(dst_dirfd, name, have_stat ? statbuf.st_mode & 07777 : 0644) == -1 && errno != EEXIST) {
+			perror("mkfifoat");
+			atomic_store(&dir_ref->incomplete, 1);
+		} else {
+			if (params->fanout != NULL) {
+				mirror_entry(walker, src_dirfd, name, DT_FIFO, have_stat ? statbuf.st_mode & 07777 : 0644);
+			}
+			if (params->meta != NULL) {
+				meta_add_file(params->meta, dir_ref, dir_ref_add_name(dir_ref, name), 0);
+			}
+		}
+		walker->fifo_files++;    // Increment the FIFO file count
+	} else if (type == DT_LNK) {  // If the entry is a symbolic link
+		if (params->verbose) {
+			pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
+			printf("Creating symlink: %s/%s\n", dir_ref->dst, name);    // Print the symlink creation message
+			pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
+		}
+		if (params->plan != NULL) {
+			walker->symlinks++;
+		} else if (params->tar != NULL) {
+			if (!have_stat) {
+				have_stat = fstatat(src_dirfd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0;
+			}
+			archive_special(walker, dir_ref, name, have_stat ? &statbuf : NULL);
+		} else if (copy_symlink(src_dirfd, dst_dirfd, name) == -1) {
+			perror("symlink");
+			atomic_store(&dir_ref->incomplete, 1);
+		} else {
+			walker->symlinks++;
+			if (params->fanout != NULL) {
+				mirror_entry(walker, src_dirfd, name, DT_LNK, 0);
+			}
+			if (params->meta != NULL) {
+				meta_add_file(params->meta, dir_ref, dir_ref_add_name(dir_ref, name), 0);
+			}
+		}
+	}
+}
+
+// Give the directory's files the queue of its source and destination devices. A mount point
+// inside the tree gets its own queue from here on; an archive counts as the device it lies on.
+static void assign_device(thread_params_t *params, dir_ref_t *dir_ref, int src_fd, int dst_fd) {
+	struct stat src_stat, dst_stat;
+	dev_t src_dev = fstat(src_fd, &src_stat) == 0 ? src_stat.st_dev : 0;
+	dev_t dst_dev = params->tar != NULL ? params->tar->dev : 0;
+	if (dst_fd != -1 && fstat(dst_fd, &dst_stat) == 0) {
+		dst_dev = dst_stat.st_dev;
+	}
+	dir_ref->device = devices_lookup(params->devices, src_dev, dst_dev);
+}
+
+// Fan-out: open the directory in every further destination by path. A missing one keeps -1,
+// so its entries fail there and the directory is not journaled as done.
+static void open_mirrors(walker_t *walker, dir_ref_t *dir_ref) {
+	fanout_t *fanout = walker->walk->params->fanout;
+	char path[MAX_PATH];
+	for (int i = 1; i < fanout->count; i++) {
+		fanout_path(fanout, i, dir_ref->dst, path, sizeof(path));
+		walker->mirror_fds[i] = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (walker->mirror_fds[i] == -1) {
+			perror(path);
+			atomic_store(&dir_ref->incomplete, 1);
+		}
+	}
+}
+
+// Function to traverse the source directory and add files to the buffer. Entries are read in
+// large getdents64 batches and every lookup is relative to the directory descriptors, so the
+// kernel never walks the full path again. src_fd and dst_fd are consumed; -1 opens by path.
+void traverse_directory(dir_ref_t *dir_ref, int src_fd, int dst_fd, walker_t *walker) {
+	thread_params_t *params = walker->walk->params;  // Shared thread parameters
+	if (src_fd == -1 && (src_fd = open(dir_ref->src, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {    // Open the source directory
+		perror("open src dir");
+		atomic_store(&dir_ref->incomplete, 1);
+		if (dst_fd != -1) close(dst_fd);
+		return;
+	}
+	if (dst_fd == -1 && writes_destination(params) && (dst_fd = open(dir_ref->dst, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+		perror("open dst dir");
+		atomic_store(&dir_ref->incomplete, 1);
+		close(src_fd);
+		return;
+	}
+	if (params->devices != NULL) {
+		assign_device(params, dir_ref, src_fd, dst_fd);
+	}
+	if (params->fanout != NULL) {
+		open_mirrors(walker, dir_ref);
+	}
+	for (;;) {
+		long count = syscall(SYS_getdents64, src_fd, walker->dents, TRAVERSE_DENTS_SIZE);   // Read a batch of entries
+		if (count == -1) {
+			perror("getdents64");
+			atomic_store(&dir_ref->incomplete, 1);
+			break;
+		}
+		if (count == 0) break;    // End of directory
+		for (long pos = 0; pos < count && !termination_flag; ) {
+			struct linux_dirent64 *entry = (struct linux_dirent64 *)(walker->dents + pos);
+			pos += entry->d_reclen;
+			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {  // Skip . and ..
+				continue;
+			}
+			visit_entry(walker, dir_ref, src_fd, dst_fd, entry->d_name, entry->d_type);
+		}
+		if (termination_flag) {   // Entries may be left unread
+			atomic_store(&dir_ref->incomplete, 1);
+			break;
+		}
+	}
+	flush_tasks(walker);    // Do not hold this directory's files back while the walker looks for work
+	if (params->delete_extraneous && !termination_flag) {
+		sync_delete_extraneous(src_fd, dst_fd, dir_ref->dst, params);
+	}
+	if (params->fanout != NULL) {
+		for (int i = 1; i < params->fanout->count; i++) {
+			if (walker->mirror_fds[i] != -1) close(walker->mirror_fds[i]);
+		}
+	}
+	if (dst_fd != -1) close(dst_fd);
+	close(src_fd);   // Close the directory
+}
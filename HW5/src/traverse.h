@@ -0,0 +1,15 @@
+#ifndef TRAVERSE_H
+#define TRAVERSE_H
+
+#include "copier.h"
+
+#define TRAVERSE_DEFAULT_MAX 8      // Default walker count is min(num_workers, this)
+#define TRAVERSE_DENTS_SIZE (256 * 1024)    // Bytes of directory entries fetched per getdents64 call
+#define TRAVERSE_HELD_DIRS 256      // Queued directories that keep their descriptors open
+
+typedef struct walker walker_t;
+
+void traverse_tree(thread_params_t *params);
+void traverse_directory(dir_ref_t *dir_ref, int src_fd, int dst_fd, walker_t *walker);
+
+#endif //TRAVERSE_H
@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+#include "uring_copy.h"
+#include "copier.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// io_uring instance mapped by hand so the copier does not depend on liburing
+typedef struct {
+	int fd;                     // Ring file descriptor
+	unsigned *sq_head;          // Submission queue head (advanced by the kernel)
+	unsigned *sq_tail;          // Submission queue tail (advanced by us)
+	unsigned *sq_mask;          // Submission queue index mask
+	unsigned *sq_array;         // Submission queue index array
+	struct io_uring_sqe *sqes;  // Submission queue entries
+	unsigned *cq_head;          // Completion queue head (advanced by us)
+	unsigned *cq_tail;          // Completion queue tail (advanced by the kernel)
+	unsigned *cq_mask;          // Completion queue index mask
+	struct io_uring_cqe *cqes;  // Completion queue entries
+	void *sq_ring;              // Mapping of the submission ring
+	void *cq_ring;              // Mapping of the completion ring (may equal sq_ring)
+	size_t sq_ring_size;        // Size of the submission ring mapping
+	size_t cq_ring_size;        // Size of the completion ring mapping
+	size_t sqes_size;           // Size of the SQE array mapping
+	unsigned to_submit;         // Entries queued since the last io_uring_enter()
+} uring_t;
+
+// A file being copied by one io_uring worker
+typedef struct uring_file {
+	file_info_t info;           // Source and destination paths
+	int src_fd;                 // Source file descriptor
+	int dst_fd;                 // Destination file descriptor
+	off_t size;                 // Bytes to copy, taken from fstat() at open time
+	off_t next_offset;          // First offset not yet handed to a slot
+	int inflight;               // Slots currently working on this file
+	int error;                  // First errno seen, 0 if none
+	long long bytes;            // Bytes written so far
+	long long start_ns;         // When the file was dequeued
+	dedup_entry_t *dedup;       // Marked linkable once the copy succeeds, NULL if not tracked
+	struct uring_file *next;    // Next file in the worker's active list
+} uring_file_t;
+
+// One in-flight request: a chunk that is read into buf and then written out
+typedef struct {
+	uring_file_t *file;         // Owning file, NULL when the slot is free
+	off_t offset;               // Current offset of the chunk
+	size_t length;              // Bytes of the chunk still to copy
+	size_t filled;              // Bytes returned by the last read
+	size_t written;             // Bytes of filled already written
+	int writing;                // 1 while a write is outstanding, 0 while a read is
+	char *buf;                  // Chunk buffer
+} uring_slot_t;
+
+// Per-worker state
+typedef struct {
+	thread_params_t *params;    // Shared thread parameters
+	worker_t *worker;           // Statistics shard of this worker
+	uring_t ring;               // The worker's ring
+	uring_slot_t *slots;        // depth slots
+	int *free_slots;            // Stack of free slot indices
+	int free_count;             // Number of free slots
+	int depth;                  // Number of slots
+	size_t chunk;               // Bytes per read/write
+	uring_file_t *active;       // Files with open descriptors
+} uring_worker_t;
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Create the ring and map its queues
+static int uring_init(uring_t *ring, unsigned depth) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = uring_setup(depth, &p);
+	if (ring->fd < 0) {
+		return -1;
+	}
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {   // Both rings share one mapping
+		if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = 0;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		close(ring->fd);
+		return -1;
+	}
+	ring->cq_ring = ring->sq_ring;
+	if (ring->cq_ring_size > 0) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			munmap(ring->sq_ring, ring->sq_ring_size);
+			close(ring->fd);
+			return -1;
+		}
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cq_ring_size > 0) munmap(ring->cq_ring, ring->cq_ring_size);
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		close(ring->fd);
+		return -1;
+	}
+
+	char *sq = ring->sq_ring;
+	char *cq = ring->cq_ring;
+	ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+static void uring_destroy(uring_t *ring) {
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring_size > 0) munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+// Queue one read or write. The worker never has more slots than SQ entries, so there is always room.
+static void uring_queue_rw(uring_t *ring, int opcode, int fd, void *addr, size_t len, off_t offset, int slot) {
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (unsigned char)opcode;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)addr;
+	sqe->len = (unsigned)len;
+	sqe->off = (unsigned long long)offset;
+	sqe->user_data = (unsigned long long)slot;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);   // Publish the entry to the kernel
+	ring->to_submit++;
+}
+
+// Submit queued entries and wait until at least one completion is available
+static int uring_submit_and_wait(uring_t *ring) {
+	for (;;) {
+		int ret = uring_enter(ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS);
+		if (ret >= 0) {
+			ring->to_submit -= (unsigned)ret;
+			if (ring->to_submit == 0) return 0;
+			continue;   // Partial submission, push the rest
+		}
+		if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+			continue;   // SIGINT or a full CQ, the reap loop will make progress
+		}
+		return -1;
+	}
+}
+
+static void issue_read(uring_worker_t *w, int index) {
+	uring_slot_t *slot = &w->slots[index];
+	size_t len = slot->length < w->chunk ? slot->length : w->chunk;
+	slot->writing = 0;
+	uring_queue_rw(&w->ring, IORING_OP_READ, slot->file->src_fd, slot->buf, len, slot->offset, index);
+}
+
+static void issue_write(uring_worker_t *w, int index) {
+	uring_slot_t *slot = &w->slots[index];
+	slot->writing = 1;
+	uring_queue_rw(&w->ring, IORING_OP_WRITE, slot->file->dst_fd, slot->buf + slot->written,
+			slot->filled - slot->written, slot->offset + (off_t)slot->written, index);
+}
+
+// Close a finished file, record its statistics and drop it from the active list
+static void finish_file(uring_worker_t *w, uring_file_t *file) {
+	uring_file_t **link = &w->active;
+	while (*link != file) link = &(*link)->next;
+	*link = file->next;
+
+	if (w->worker->copy.drop_cache && !file->error) {   // As drop_cached does for the blocking workers
+		off_t offset = file->info.chunked != NULL ? file->info.offset : 0;
+		off_t length = file->info.chunked != NULL ? file->info.length : 0;
+		sync_file_range(file->dst_fd, offset, length, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(file->dst_fd, offset, length, POSIX_FADV_DONTNEED);   // Only clean pages can be dropped
+		posix_fadvise(file->src_fd, offset, length, POSIX_FADV_DONTNEED);
+	}
+	close(file->src_fd);
+	close(file->dst_fd);
+	if (file->error) {
+		char src[MAX_PATH];
+		task_src_path(&file->info, src, sizeof(src));
+		errno = file->error;
+		perror(src);
+	}
+	copy_result_t result = {.method = COPY_METHOD_IO_URING, .bytes = file->bytes};
+	off_t expected = file->size - (file->info.chunked != NULL ? file->info.offset : 0);
+	int cut_short = termination_flag && file->bytes < expected;     // Stopped by SIGINT, must not count as copied
+	dedup_finish(file->dedup, file->error || cut_short ? -1 : 0);
+	record_copy(w->worker, &file->info, file->error || cut_short ? -1 : 0, &result, file->start_ns);
+	free(file);
+}
+
+static void release_slot(uring_worker_t *w, int index) {
+	uring_slot_t *slot = &w->slots[index];
+	uring_file_t *file = slot->file;
+	slot->file = NULL;
+	w->free_slots[w->free_count++] = index;
+	file->inflight--;
+	if (file->inflight == 0 && (file->error || file->next_offset >= file->size || termination_flag)) {
+		finish_file(w, file);
+	}
+}
+
+// Open a dequeued file; returns NULL (after reporting) if it cannot be opened
+static uring_file_t *open_file(uring_worker_t *w, const file_info_t *info) {
+	copy_result_t failed = {.method = COPY_METHOD_IO_URING, .bytes = 0};
+	long long start_ns = stats_now_ns();
+	uring_file_t *file = (uring_file_t *)calloc(1, sizeof(uring_file_t));
+	if (file == NULL) {
+		perror("calloc");
+		record_copy(w->worker, info, -1, &failed, start_ns);
+		return NULL;
+	}
+	char src[MAX_PATH], dst[MAX_PATH];  // Full paths rebuilt from the interned directory
+	task_src_path(info, src, sizeof(src));
+	task_dst_path(info, dst, sizeof(dst));
+	file->info = *info;
+	file->start_ns = start_ns;
+	file->src_fd = open(src, O_RDONLY);    // Open source file for reading
+	if (file->src_fd == -1) {
+		perror("open src");
+		free(file);
+		record_copy(w->worker, info, -1, &failed, start_ns);
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(file->src_fd, &st) == -1) {
+		perror("fstat");
+		close(file->src_fd);
+		free(file);
+		record_copy(w->worker, info, -1, &failed, start_ns);
+		return NULL;
+	}
+	copy_result_t result = {0};
+	if (info->chunked == NULL && w->params->dedup != NULL &&
+			dedup_find(w->params->dedup, src, dst, st.st_size, &w->worker->copy, &file->dedup, &result) == 1) {
+		close(file->src_fd);    // Linked or cloned from an identical file
+		free(file);
+		record_copy(w->worker, info, 0, &result, start_ns);
+		return NULL;
+	}
+	if (copy_is_sparse(&st)) {      // Fixed-size reads would fill the holes, copy the data extents inline
+		close(file->src_fd);
+		int status = info->chunked != NULL
+				? copy_file_part(src, dst, info->offset, info->length, &w->worker->copy, &result)
+				: copy_file(src, dst, &w->worker->copy, &result);
+		dedup_finish(file->dedup, status);
+		free(file);
+		record_copy(w->worker, info, status, &result, start_ns);
+		return NULL;
+	}
+	if (info->chunked != NULL) {    // Chunk of a split file, the destination is already sized
+		file->dst_fd = open(dst, O_WRONLY);
+	} else {
+		file->dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);   // Open destination file for writing
+	}
+	if (file->dst_fd == -1) {
+		perror("open dst");
+		close(file->src_fd);
+		free(file);
+		record_copy(w->worker, info, -1, &failed, start_ns);
+		return NULL;
+	}
+	off_t clone_length = info->chunked != NULL ? info->length : 0;
+	if (w->worker->copy.engine == ENGINE_AUTO && st.st_size > 0 &&
+			copy_clone(file->src_fd, file->dst_fd, info->chunked != NULL ? info->offset : 0, clone_length) == 0) {
+		result.method = COPY_METHOD_CLONE;  // Same CoW filesystem, no reads or writes to queue
+		result.bytes = clone_length > 0 ? clone_length : st.st_size;
+		close(file->src_fd);
+		close(file->dst_fd);
+		dedup_finish(file->dedup, 0);
+		free(file);
+		record_copy(w->worker, info, 0, &result, start_ns);
+		return NULL;
+	}
+	file->size = st.st_size;
+	if (info->chunked != NULL) {    // Copy only [offset, offset + length)
+		file->next_offset = info->offset;
+		file->size = info->offset + info->length < st.st_size ? info->offset + info->length : st.st_size;
+	} else if (st.st_size >= COPY_PREALLOC_MIN) {   // Reserve the extents before the writes land, best effort
+		fallocate(file->dst_fd, FALLOC_FL_KEEP_SIZE, 0, st.st_size);
+	}
+	file->next = w->active;
+	w->active = file;
+	return file;
+}
+
+// Hand the next chunk of file to a free slot and queue its read
+static void start_chunk(uring_worker_t *w, uring_file_t *file) {
+	int index = w->free_slots[--w->free_count];
+	uring_slot_t *slot = &w->slots[index];
+	off_t remaining = file->size - file->next_offset;
+	slot->file = file;
+	slot->offset = file->next_offset;
+	slot->length = remaining < (off_t)w->chunk ? (size_t)remaining : w->chunk;
+	file->next_offset += (off_t)slot->length;
+	file->inflight++;
+	issue_read(w, index);
+}
+
+// Process one completion
+static void handle_cqe(uring_worker_t *w, int index, int res) {
+	uring_slot_t *slot = &w->slots[index];
+	uring_file_t *file = slot->file;
+	if (res == -EINTR || res == -EAGAIN) {   // Transient, resubmit the same request
+		if (slot->writing) issue_write(w, index); else issue_read(w, index);
+		return;
+	}
+	if (res < 0) {
+		if (!file->error) file->error = -res;
+		release_slot(w, index);
+		return;
+	}
+	if (!slot->writing) {
+		if (res == 0) {     // Source shrank since fstat(), nothing more to copy here
+			release_slot(w, index);
+			return;
+		}
+		slot->filled = (size_t)res;
+		slot->written = 0;
+		issue_write(w, index);
+		return;
+	}
+	slot->written += (size_t)res;
+	file->bytes += res;
+	if (slot->written < slot->filled) {  // Short write, push the rest
+		issue_write(w, index);
+		return;
+	}
+	slot->offset += (off_t)slot->filled;
+	slot->length -= slot->filled;
+	if (slot->length > 0 && !file->error && !termination_flag) {   // Short read, continue the chunk
+		issue_read(w, index);
+		return;
+	}
+	release_slot(w, index);
+}
+
+// Drain every available completion
+static void reap_completions(uring_worker_t *w) {
+	uring_t *ring = &w->ring;
+	unsigned head = *ring->cq_head;
+	while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		int index = (int)cqe->user_data;
+		int res = cqe->res;
+		head++;
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);   // Give the entry back before handling it
+		handle_cqe(w, index, res);
+	}
+}
+
+// Compare-then-copy or delta task from sync mode, handled with blocking I/O
+static void copy_sync_task(worker_t *worker, const file_info_t *info) {
+	thread_params_t *params = worker->params;
+	long long start_ns = stats_now_ns();
+	char src[MAX_PATH], dst[MAX_PATH];
+	task_src_path(info, src, sizeof(src));
+	task_dst_path(info, dst, sizeof(dst));
+	copy_result_t result = {0};
+	int status;
+	if (info->flags & TASK_DELTA) {
+		status = copy_file_delta(src, dst, info->chunked ? info->offset : 0, info->chunked ? info->length : 0,
+				(size_t)params->delta_block, &result);
+	} else {
+		status = copy_file_if_changed(src, dst, info->chunked ? info->offset : 0, info->chunked ? info->length : 0,
+				&worker->copy, &result);
+	}
+	record_copy(worker, info, status, &result, start_ns);
+}
+
+// Pick an active file that still has bytes not assigned to any slot
+static uring_file_t *file_with_work(uring_worker_t *w) {
+	for (uring_file_t *file = w->active; file != NULL; file = file->next) {
+		if (!file->error && file->next_offset < file->size) return file;
+	}
+	return NULL;
+}
+
+static void run_worker(uring_worker_t *w) {
+	thread_params_t *params = w->params;
+	int draining = 0;   // Manager is done and the buffer is empty
+	for (;;) {
+		// Keep every slot busy: new files first so small files overlap, then extra chunks of large ones
+		while (w->free_count > 0 && !termination_flag) {
+			uring_file_t *file = NULL;
+			if (!draining) {
+				file_info_t info;
+				int inflight = w->depth - w->free_count;
+				int status;
+				if (inflight == 0 && file_with_work(w) == NULL) {    // Nothing to overlap with, block for the next task
+					long long wait_start = stats_now_ns();
+					if (params->pool != NULL && !pool_wait_active(params->pool, w->worker->id)) {
+						w->worker->stats->idle_ns += stats_now_ns() - wait_start;
+						draining = 1;   // Parked when the pool was released, the active workers finish up
+						continue;
+					}
+					status = buffer_remove(params->buffer, &info);
+					w->worker->stats->idle_ns += stats_now_ns() - wait_start;
+				} else {
+					status = buffer_try_remove(params->buffer, &info);
+				}
+				if (status == 1 && (info.flags & (TASK_COMPARE | TASK_DELTA))) {  // Sync compare reads both files, do it inline
+					copy_sync_task(w->worker, &info);
+					continue;
+				}
+				if (status == 1) {
+					file = open_file(w, &info);
+					if (file == NULL) continue;
+					if (file->next_offset >= file->size) {      // Nothing to read, the open already created it
+						finish_file(w, file);
+						continue;
+					}
+				} else if (status == 0) {
+					draining = 1;
+				}
+			}
+			if (file == NULL) file = file_with_work(w);
+			if (file == NULL) break;
+			start_chunk(w, file);
+		}
+
+		if (w->free_count == w->depth) {     // Nothing in flight
+			if (draining || termination_flag) break;
+			continue;
+		}
+		if (uring_submit_and_wait(&w->ring) == -1) {
+			perror("io_uring_enter");
+			break;
+		}
+		reap_completions(w);
+	}
+}
+
+// Worker thread function for io_uring mode: keeps up to uring_depth reads and writes in flight
+// across many files instead of copying one file at a time
+void *uring_worker_thread(void *arg) {
+	worker_t *worker = (worker_t *)arg;     // This worker's context
+	thread_params_t *params = worker->params;    // Get the thread parameters
+	uring_worker_t w;
+	memset(&w, 0, sizeof(w));
+	w.params = params;
+	w.worker = worker;
+	w.depth = params->uring_depth;
+	w.chunk = params->buffer_size > URING_CHUNK_MIN ? (size_t)params->buffer_size : URING_CHUNK_MIN;
+
+	if (uring_init(&w.ring, (unsigned)w.depth) == -1) {
+		pthread_mutex_lock(&params->output_mutex);  // Lock the output mutex
+		fprintf(stderr, "io_uring unavailable (%s), using blocking copies\n", strerror(errno));
+		pthread_mutex_unlock(&params->output_mutex);  // Unlock the output mutex
+		return worker_thread(arg);
+	}
+	w.slots = (uring_slot_t *)calloc((size_t)w.depth, sizeof(uring_slot_t));
+	w.free_slots = (int *)malloc(sizeof(int) * (size_t)w.depth);
+	char *buffers = (char *)malloc(w.chunk * (size_t)w.depth);
+	if (w.slots == NULL || w.free_slots == NULL || buffers == NULL) {
+		perror("malloc");
+		free(w.slots);
+		free(w.free_slots);
+		free(buffers);
+		uring_destroy(&w.ring);
+		return worker_thread(arg);
+	}
+	for (int i = 0; i < w.depth; i++) {
+		w.slots[i].buf = buffers + (size_t)i * w.chunk;
+		w.free_slots[w.free_count++] = w.depth - 1 - i;
+	}
+
+	long long started = stats_now_ns();
+	run_worker(&w);
+
+	while (w.active != NULL) {  // Only left behind by an io_uring_enter failure or SIGINT
+		finish_file(&w, w.active);
+	}
+	if (termination_flag) {     // Walkers may be blocked on a full buffer, drain it without copying
+		file_info_t info;
+		copy_result_t dropped = {.method = COPY_METHOD_IO_URING, .bytes = 0};
+		while (buffer_remove(params->buffer, &info) == 1) {
+			record_copy(worker, &info, -1, &dropped, stats_now_ns());
+		}
+	}
+	uring_destroy(&w.ring);     // Tear the ring down before its buffers
+	free(buffers);
+	free(w.slots);
+	free(w.free_slots);
+	worker->stats->busy_ns = stats_now_ns() - started - worker->stats->idle_ns;
+	pthread_barrier_wait(&params->barrier);  // Wait at the barrier
+	return NULL;
+}
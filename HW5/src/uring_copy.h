@@ -0,0 +1,10 @@
+#ifndef URING_COPY_H
+#define URING_COPY_H
+
+#define URING_DEFAULT_DEPTH 64      // Requests in flight per worker when -u has no value
+#define URING_MAX_DEPTH 4096        // Upper bound accepted on the command line
+#define URING_CHUNK_MIN (128 * 1024)    // Smallest read/write issued by an io_uring worker
+
+void *uring_worker_thread(void *arg);
+
+#endif //URING_COPY_H
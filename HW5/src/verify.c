@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "verify.h"
+#include "copier.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// One verify thread and the worker buffer it reads through
+typedef struct {
+	verify_t *verify;
+	copy_ctx_t *ctx;
+} verifier_t;
+
+void verify_init(verify_t *verify) {
+	memset(verify, 0, sizeof(*verify));
+	pthread_mutex_init(&verify->mutex, NULL);
+	atomic_init(&verify->next, 0);
+	atomic_init(&verify->files, 0);
+	atomic_init(&verify->bytes, 0);
+	atomic_init(&verify->mismatched, 0);
+	atomic_init(&verify->failed, 0);
+}
+
+void verify_destroy(verify_t *verify) {
+	for (size_t i = 0; i < verify->count; i++) {
+		free(verify->entries[i].path);
+	}
+	free(verify->entries);
+	pthread_mutex_destroy(&verify->mutex);
+}
+
+// Called by a worker when the last piece of a file is copied
+void verify_add(verify_t *verify, const char *path, uint64_t digest) {
+	char *copy = strdup(path);
+	if (copy == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_lock(&verify->mutex);
+	if (verify->count == verify->capacity) {
+		size_t capacity = verify->capacity ? verify->capacity * 2 : 1024;
+		verify_entry_t *entries = (verify_entry_t *)realloc(verify->entries, sizeof(verify_entry_t) * capacity);
+		if (entries == NULL) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		verify->entries = entries;
+		verify->capacity = capacity;
+	}
+	verify->entries[verify->count++] = (verify_entry_t){.path = copy, .digest = digest};
+	pthread_mutex_unlock(&verify->mutex);
+}
+
+// Digest of a destination file read back from the disk, holes hashed as zeros without reading
+// them. Returns 0, or -1 with errno set.
+static int hash_file(const char *path, copy_ctx_t *ctx, uint64_t *digest, long long *bytes) {
+	int fd = open(path, O_RDONLY | O_NOATIME | O_CLOEXEC);  // Leave the preserved access times alone
+	if (fd == -1 && errno == EPERM) {
+		fd = open(path, O_RDONLY | O_CLOEXEC);      // O_NOATIME needs ownership
+	}
+	if (fd == -1) return -1;
+	fdatasync(fd);      // Dirty pages cannot be dropped; write them back first
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	struct stat st;
+	checksum_stream_t stream;
+	checksum_stream_begin(&stream, 0);
+	int status = fstat(fd, &st);
+	off_t pos = 0;
+	while (status == 0 && pos < st.st_size) {
+		off_t data = lseek(fd, pos, SEEK_DATA);
+		if (data == -1 && errno == ENXIO) data = st.st_size;    // Only a hole is left
+		if (data == -1) {
+			status = -1;
+			break;
+		}
+		if (data > st.st_size) data = st.st_size;
+		checksum_stream_zeros(&stream, data - pos);
+		pos = data;
+		off_t hole = pos < st.st_size ? lseek(fd, pos, SEEK_HOLE) : pos;
+		if (hole == -1) {
+			status = -1;
+			break;
+		}
+		if (hole > st.st_size) hole = st.st_size;
+		while (pos < hole) {
+			size_t want = hole - pos < (off_t)ctx->buf_size ? (size_t)(hole - pos) : ctx->buf_size;
+			ssize_t n = pread(fd, ctx->buf, want, pos);
+			if (n == -1 && errno == EINTR) continue;
+			if (n == -1) {
+				status = -1;
+				break;
+			}
+			if (n == 0) {   // Shrank under us, the digest will tell
+				st.st_size = pos;
+				break;
+			}
+			checksum_stream_update(&stream, ctx->buf, (size_t)n);
+			pos += n;
+			*bytes += n;
+		}
+	}
+	int saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	*digest = checksum_stream_end(&stream);
+	return status;
+}
+
+static void *verify_thread(void *arg) {
+	verifier_t *v = (verifier_t *)arg;
+	verify_t *verify = v->verify;
+	size_t i;
+	while (!termination_flag && (i = atomic_fetch_add(&verify->next, 1)) < verify->count) {
+		verify_entry_t *entry = &verify->entries[i];
+		uint64_t digest;
+		long long bytes = 0;
+		if (hash_file(entry->path, v->ctx, &digest, &bytes) == -1) {
+			perror(entry->path);
+			atomic_fetch_add(&verify->failed, 1);
+		} else if (digest != entry->digest) {
+			fprintf(stderr, "Verify: %s differs from its source\n", entry->path);
+			atomic_fetch_add(&verify->mismatched, 1);
+		} else {
+			atomic_fetch_add(&verify->files, 1);
+		}
+		atomic_fetch_add(&verify->bytes, bytes);
+	}
+	return NULL;
+}
+
+// Check every added file on count threads, each reading through its own worker's buffer.
+// Runs after the workers have finished; SIGINT stops it between files.
+void verify_run(verify_t *verify, copy_ctx_t *const *ctxs, int count) {
+	long long start = stats_now_ns();
+	if ((size_t)count > verify->count) count = verify->count > 0 ? (int)verify->count : 1;
+	pthread_t threads[count];
+	verifier_t args[count];
+	int started = 0;
+	for (int i = 0; i < count; i++) {
+		args[i] = (verifier_t){.verify = verify, .ctx = ctxs[i]};
+		if (pthread_create(&threads[i], NULL, verify_thread, &args[i]) != 0) {
+			perror("pthread_create");
+			break;
+		}
+		started++;
+	}
+	if (started == 0) {
+		verify_thread(&args[0]);    // Check on this thread instead
+	}
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	verify->seconds = (stats_now_ns() - start) / 1e9;
+}
+
+void verify_write_json(const verify_t *verify, FILE *out) {
+	fprintf(out, "  \"verify\": {\"files\": %lld, \"bytes\": %lld, \"mismatched\": %lld, \"failed\": %lld, \"elapsed_us\": %lld},\n",
+			(long long)atomic_load(&verify->files), (long long)atomic_load(&verify->bytes),
+			(long long)atomic_load(&verify->mismatched), (long long)atomic_load(&verify->failed), (long long)(verify->seconds * 1e6));
+}
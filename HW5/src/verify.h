@@ -0,0 +1,39 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "copy_engine.h"
+
+// One copied file and the digest of the source bytes that went into it
+typedef struct {
+	char *path;                 // Destination path
+	uint64_t digest;            // checksum_stream_t digest of the whole source file
+} verify_entry_t;
+
+// Post-copy verification. Workers hash the source in their copy buffer as it passes through
+// (see copy_ctx_t.hash), so the source is read once; each finished file is added here with
+// its digest. verify_run() then re-reads every destination on several threads, after
+// flushing it and dropping its cached pages so the bytes come from the disk, and compares.
+typedef struct verify {
+	pthread_mutex_t mutex;      // Protects entries while the workers add to them
+	verify_entry_t *entries;    // Files to check
+	size_t count;
+	size_t capacity;
+	atomic_size_t next;         // Next entry a verify thread takes
+	atomic_llong files;         // Destinations that matched
+	atomic_llong bytes;         // Bytes re-read
+	atomic_llong mismatched;    // Destinations that differ from their source
+	atomic_llong failed;        // Destinations that could not be read
+	double seconds;             // Wall time of verify_run
+} verify_t;
+
+void verify_init(verify_t *verify);
+void verify_destroy(verify_t *verify);
+void verify_add(verify_t *verify, const char *path, uint64_t digest);
+void verify_run(verify_t *verify, copy_ctx_t *const *ctxs, int count);
+void verify_write_json(const verify_t *verify, FILE *out);
+
+#endif //VERIFY_H